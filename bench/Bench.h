@@ -0,0 +1,54 @@
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <inttypes.h>
+#include <time.h>
+
+/*
+ * Minimal host microbenchmark harness: body is repeated with growing iteration
+ * count until one run takes at least BENCH_MIN_TIME, result is ns. per call.
+ * Heap allocations (malloc(), calloc(), realloc() and so new) are counted by
+ * bench.cpp, allocations per call of the last run are optionally returned too.
+ */
+static const uint64_t BENCH_MIN_TIME = 200000000; // 200 ms. in ns.
+
+extern volatile uint32_t benchSink; // Results are stored here so they are not optimized out
+extern volatile uint64_t benchAllocs;
+extern const uint8_t benchLogRecord; // LOG_RECORD of src/main.cpp, defined by BenchGateway.cpp
+
+static inline uint64_t benchNow() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+template <class F>
+double benchNs(F body, double *allocs = NULL) {
+  uint32_t iterations = 1;
+
+  for (;;) {
+    uint64_t start_allocs = benchAllocs;
+    uint64_t start = benchNow();
+    uint64_t elapsed;
+
+    for (uint32_t i = 0; i < iterations; ++i) {
+      body();
+    }
+    elapsed = benchNow() - start;
+    if ((elapsed >= BENCH_MIN_TIME) || (iterations >= 0x40000000)) {
+      if (allocs)
+        *allocs = (double)(benchAllocs - start_allocs) / iterations;
+      return (double)elapsed / iterations;
+    }
+    iterations *= 2;
+  }
+}
+
+void benchTlv();
+void benchFlashLog();
+void benchContainers();
+void benchGateway();
+
+#endif
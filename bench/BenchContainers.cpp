@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <string.h>
+#include "Bench.h"
+#ifndef __packed
+#define __packed __attribute__((packed))
+#endif
+#include "Queue.h"
+#include "List.h"
+
+/*
+ * Containers of BtnLed_ESP_Library: Queue and SpscQueue put/get, List add/remove
+ * (on heap and on static pool) and StaticList linear find, in ns. and heap
+ * allocations per call.
+ */
+
+namespace {
+
+struct __attribute__((packed)) item_t { // Size of payload_t in src/main.cpp
+  uint32_t id;
+  uint32_t uptime;
+};
+
+void print(const char *name, double ns, double allocs) {
+  printf("%-32s %9.1f ns/op, %5.2f allocs/op\n", name, ns, allocs);
+}
+
+void benchQueue() {
+  Queue<item_t, 32> queue;
+  item_t item = { 0x00A1B2C3, 0 };
+  double ns, allocs;
+
+  ns = benchNs([&]() {
+    ++item.uptime;
+    queue.put(&item);
+    benchSink += queue.get()->uptime;
+  }, &allocs);
+  print("Queue put + get", ns, allocs);
+  ns = benchNs([&]() {
+    for (uint8_t i = 0; i < 32; ++i) {
+      item.uptime = i;
+      queue.put(&item);
+    }
+    while (const item_t *t = queue.get()) {
+      benchSink += t->uptime;
+    }
+  }, &allocs);
+  print("Queue fill + drain 32", ns / 32, allocs / 32);
+}
+
+void benchSpscQueue() {
+  SpscQueue<item_t, 32> queue;
+  item_t item = { 0x00A1B2C3, 0 };
+  item_t items[32];
+  double ns, allocs;
+
+  ns = benchNs([&]() {
+    ++item.uptime;
+    queue.put(&item);
+    queue.get(item);
+    benchSink += item.uptime;
+  }, &allocs);
+  print("SpscQueue put + get", ns, allocs);
+  for (uint8_t i = 0; i < 32; ++i) {
+    items[i] = item;
+  }
+  ns = benchNs([&]() {
+    for (uint8_t i = 0; i < 32; ++i) {
+      items[i].uptime = i;
+      queue.put(&items[i]);
+    }
+    while (queue.get(item)) {
+      benchSink += item.uptime;
+    }
+  }, &allocs);
+  print("SpscQueue fill + drain 32", ns / 32, allocs / 32);
+  ns = benchNs([&]() {
+    queue.put_n(items, 32);
+    benchSink += queue.get_n(items, 32);
+  }, &allocs);
+  print("SpscQueue put_n + get_n 32", ns / 32, allocs / 32);
+}
+
+void *poolAlloc(void *ptr, size_t size) { // Static pool for a single list, as realloc()
+  static item_t pool[255];
+
+  return size <= sizeof(pool) ? pool : NULL;
+}
+
+void benchList(uint8_t count, bool pool = false) {
+  List<item_t> list(pool ? poolAlloc : NULL);
+  item_t item = { 0x00A1B2C3, 0 };
+  char name[40];
+  double ns, allocs;
+
+  for (uint8_t i = 0; i < count; ++i) {
+    item.uptime = i;
+    list.add(item);
+  }
+  ns = benchNs([&]() {
+    benchSink += list.add(item);
+    list.remove(list.count() - 1);
+  }, &allocs);
+  snprintf(name, sizeof(name), "List add + remove last @%u%s", count, pool ? " pool" : "");
+  print(name, ns / 2, allocs / 2);
+  ns = benchNs([&]() {
+    list.add(item);
+    list.remove(0);
+  }, &allocs);
+  snprintf(name, sizeof(name), "List add + remove first @%u%s", count, pool ? " pool" : "");
+  print(name, ns / 2, allocs / 2);
+}
+
+void benchStaticList(uint8_t count) {
+  StaticList<item_t> list;
+  item_t item = { 0x00A1B2C3, 0 };
+  item_t missing = { 0, 0 };
+  char name[40];
+  double ns, allocs;
+
+  for (uint8_t i = 0; i < count; ++i) {
+    item.uptime = i;
+    list.add(item);
+  }
+  ns = benchNs([&]() { benchSink += list.find(item); }, &allocs); // Last one
+  snprintf(name, sizeof(name), "StaticList find last @%u", count);
+  print(name, ns, allocs);
+  ns = benchNs([&]() { benchSink += list.find(missing); }, &allocs);
+  snprintf(name, sizeof(name), "StaticList find miss @%u", count);
+  print(name, ns, allocs);
+}
+
+}
+
+void benchContainers() {
+  double ns, allocs;
+
+  benchQueue();
+  benchSpscQueue();
+  benchList(0);
+  benchList(16);
+  benchList(64);
+  benchList(64, true);
+  ns = benchNs([&]() {
+    List<item_t> list;
+    item_t item = { 0x00A1B2C3, 0 };
+
+    for (uint8_t i = 0; i < 64; ++i) {
+      item.uptime = i;
+      list.add(item);
+    }
+    benchSink += list.count();
+  }, &allocs);
+  print("List fill 64", ns / 64, allocs / 64);
+  benchStaticList(8);
+  benchStaticList(64);
+  benchStaticList(255);
+}
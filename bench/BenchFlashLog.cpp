@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include "Bench.h"
+#include "FlashLog.h"
+
+/*
+ * FlashLog over file-backed storage: append, read back and mount (scan) cost
+ * with the gateway's record size. Host file I/O, so only relative numbers matter.
+ */
+
+namespace {
+
+const char LOG_FILE[] = "bench-flashlog.tmp";
+const uint32_t LOG_SIZE = 262144; // As on the gateway
+const uint8_t MAX_RECORD = 64; // Buffer for benchLogRecord bytes
+
+}
+
+void benchFlashLog() {
+  FileLogStorage storage(LOG_FILE, LOG_SIZE);
+  FlashLog log(&storage, sizeof(FlashLog::header_t) + benchLogRecord);
+  uint8_t record[MAX_RECORD] = { 0 };
+  double ns;
+
+  if (benchLogRecord > sizeof(record)) {
+    printf("Record of %u bytes is too long!\n", benchLogRecord);
+    return;
+  }
+  if (! log.begin()) {
+    printf("Can't open %s!\n", LOG_FILE);
+    return;
+  }
+  printf("capacity %u records of %u bytes\n", log.capacity(), benchLogRecord);
+  ns = benchNs([&]() {
+    log.append(record, benchLogRecord);
+  });
+  printf("append:          %9.1f ns.\n", ns);
+  ns = benchNs([&]() {
+    if (! log.count())
+      log.append(record, benchLogRecord);
+    benchSink += log.peek(record);
+    log.pop();
+  });
+  printf("peek + pop:      %9.1f ns.\n", ns);
+  ns = benchNs([&]() {
+    log.append(record, benchLogRecord);
+    benchSink += log.commit();
+  });
+  printf("append + commit: %9.1f ns.\n", ns);
+  ns = benchNs([&]() {
+    storage.end();
+    benchSink += log.begin();
+  });
+  printf("begin (scan):    %9.1f us.\n", ns / 1000);
+  storage.end();
+  remove(LOG_FILE);
+}
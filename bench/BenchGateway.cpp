@@ -0,0 +1,136 @@
+#include "SimPrelude.h"
+#include <stdio.h>
+#include <string.h>
+#include "Bench.h"
+
+/*
+ * Gateway per frame paths of src/main.cpp, built as in the simulator (see
+ * sim/gateway.cpp): peerByMac() over PeerTable at several peer counts, frame
+ * classification of onReceive() and dumpPacket() (Serial is muted) and topic
+ * plus value formatting done for every mqttPublish().
+ */
+
+namespace gateway {
+#include "../src/main.cpp"
+}
+
+const uint8_t benchLogRecord = gateway::LOG_RECORD;
+
+namespace {
+
+using gateway::espnow_header_t;
+using gateway::espnow_data_t;
+using gateway::espnow_ack_t;
+
+struct BenchServer : gateway::EspNowServerPlus { // Exposes protected parts to bench
+  using EspNowServerPlus::peer_t;
+  using EspNowServerPlus::PEER_SLOTS;
+  using EspNowServerPlus::_peers;
+  using EspNowServerPlus::peerByMac;
+  using EspNowServerPlus::isDataPacket;
+  using EspNowServerPlus::isBatchPacket;
+  using EspNowServerPlus::isTlvPacket;
+  using EspNowServerPlus::isFragPacket;
+};
+
+BenchServer server;
+
+void print(const char *name, double ns, double allocs) {
+  printf("%-32s %9.1f ns/op, %5.2f allocs/op\n", name, ns, allocs);
+}
+
+void makeMac(uint8_t *mac, uint16_t i) {
+  mac[0] = 0x5C; // Same vendor OUI for all, as in a real deployment
+  mac[1] = 0xCF;
+  mac[2] = 0x7F;
+  mac[3] = 0x10;
+  mac[4] = i >> 8;
+  mac[5] = i;
+}
+
+void benchPeerByMac(uint16_t count) {
+  static uint8_t macs[BenchServer::PEER_SLOTS][6];
+  uint8_t missing[6];
+  uint16_t next = 0;
+  char name[40];
+  double ns, allocs;
+
+  server._peers.clear();
+  for (uint16_t i = 0; i < count; ++i) {
+    makeMac(macs[i], i + 1);
+    server._peers.add(macs[i]);
+  }
+  ns = benchNs([&]() {
+    benchSink += server.peerByMac(macs[next])->num;
+    if (++next >= count)
+      next = 0;
+  }, &allocs);
+  snprintf(name, sizeof(name), "peerByMac hit @%u", count);
+  print(name, ns, allocs);
+  makeMac(missing, 0xFFFF);
+  ns = benchNs([&]() { benchSink += server.peerByMac(missing) != NULL; }, &allocs);
+  snprintf(name, sizeof(name), "peerByMac miss @%u", count);
+  print(name, ns, allocs);
+}
+
+void benchParse() {
+  static const struct {
+    const char *name;
+    gateway::espnow_type_t type;
+    uint8_t len;
+    uint8_t magic;
+  } FRAMES[] = {
+    { "DATA", gateway::ESPNOW_DATA, sizeof(espnow_data_t), gateway::ESPNOW_MAGIC },
+    { "TLV", gateway::ESPNOW_TLV, 39, gateway::ESPNOW_MAGIC },
+    { "ACKS", gateway::ESPNOW_ACKS, sizeof(espnow_header_t) + 10 * sizeof(espnow_ack_t), gateway::ESPNOW_MAGIC },
+    { "wrong", gateway::ESPNOW_TLV, 39, 0 },
+  };
+  uint8_t frame[250];
+  char name[40];
+  double ns, allocs;
+
+  memset(frame, 0, sizeof(frame));
+  for (uint8_t i = 0; i < sizeof(FRAMES) / sizeof(FRAMES[0]); ++i) {
+    uint8_t len = FRAMES[i].len;
+
+    ((espnow_header_t*)frame)->magic = FRAMES[i].magic;
+    ((espnow_header_t*)frame)->type = FRAMES[i].type;
+    ns = benchNs([&]() { benchSink += server.isDataPacket(frame, len); }, &allocs);
+    snprintf(name, sizeof(name), "isDataPacket %s", FRAMES[i].name);
+    print(name, ns, allocs);
+    ns = benchNs([&]() { // Order of onReceive()
+      benchSink += server.isDataPacket(frame, len) || server.isBatchPacket(frame, len) || server.isTlvPacket(frame, len) ||
+        server.isFragPacket(frame, len);
+    }, &allocs);
+    snprintf(name, sizeof(name), "onReceive classify %s", FRAMES[i].name);
+    print(name, ns, allocs);
+    ns = benchNs([&]() { gateway::dumpPacket(frame, len); }, &allocs);
+    snprintf(name, sizeof(name), "dumpPacket %s", FRAMES[i].name);
+    print(name, ns, allocs);
+  }
+}
+
+void benchTopic() {
+  const char ID[8] = { '0', '0', 'A', '1', 'B', '2', 'C', '3' };
+  uint32_t value = 3600000;
+  double ns, allocs;
+
+  strcpy_P(gateway::mqttTopic, gateway::MQTT_PREFIX); // As setup() does
+  ns = benchNs([&]() {
+    benchSink += strlen(gateway::mqttRenderTopic(gateway::SENSOR_UPTIME, ID));
+    benchSink += strlen(ultoa(++value, gateway::mqttValue, 10));
+  }, &allocs);
+  print("mqttPublish topic + value", ns, allocs);
+  ns = benchNs([&]() { benchSink += strlen(gateway::mqttRenderTopic(42, ID)); }, &allocs);
+  print("mqttPublish topic sensorNNN", ns, allocs);
+}
+
+}
+
+void benchGateway() {
+  benchPeerByMac(16);
+  benchPeerByMac(64);
+  benchPeerByMac(PeerTable<BenchServer::peer_t, BenchServer::PEER_SLOTS>::capacity());
+  benchParse();
+  benchTopic();
+}
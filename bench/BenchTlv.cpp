@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+#include "Bench.h"
+#include "Tlv.h"
+
+/*
+ * Fixed payload_t records (ESPNOW_BATCH) vs. TLV items (ESPNOW_TLV) of src/main.cpp:
+ * bytes on air per frame and encode/decode cost per frame.
+ */
+
+namespace {
+
+const uint8_t HEADER_SIZE = 4; // espnow_header_t
+const uint8_t MAX_DATA = 250 - HEADER_SIZE;
+
+enum { SENSOR_ID, SENSOR_UPTIME, SENSOR_TEMPERATURE, SENSOR_HUMIDITY, SENSOR_PRESSURE, SENSOR_VOLTAGE };
+
+struct __attribute__((packed)) payload_t { // As in src/main.cpp
+  uint32_t id;
+  uint32_t uptime;
+};
+
+struct __attribute__((packed)) sensors_t { // What a fixed struct for several sensors would be
+  uint32_t id;
+  uint32_t uptime;
+  int16_t temperature; // 0.01 C
+  uint16_t humidity; // 0.01 %
+  uint32_t pressure; // Pa
+  uint16_t voltage; // mV
+};
+
+const uint32_t CHIP_ID = 0x00A1B2C3;
+const uint32_t UPTIME = 3600000; // 1 h. in ms.
+const uint32_t PERIOD = 5000;
+
+uint8_t encodeStruct(uint8_t *buf, uint8_t readings) {
+  payload_t *records = (payload_t*)buf;
+
+  for (uint8_t i = 0; i < readings; ++i) {
+    records[i].id = CHIP_ID;
+    records[i].uptime = UPTIME + i * PERIOD;
+  }
+
+  return readings * sizeof(payload_t);
+}
+
+uint8_t encodeTlv(uint8_t *buf, uint8_t readings) {
+  TlvWriter writer(buf, MAX_DATA);
+
+  writer.putUInt(SENSOR_ID, CHIP_ID);
+  for (uint8_t i = 0; i < readings; ++i) {
+    writer.putUInt(SENSOR_UPTIME, UPTIME + i * PERIOD);
+  }
+
+  return writer.length();
+}
+
+uint8_t encodeSensorsTlv(uint8_t *buf, uint8_t readings) {
+  TlvWriter writer(buf, MAX_DATA);
+
+  writer.putUInt(SENSOR_ID, CHIP_ID);
+  for (uint8_t i = 0; i < readings; ++i) {
+    writer.putUInt(SENSOR_UPTIME, UPTIME + i * PERIOD);
+    writer.putSInt(SENSOR_TEMPERATURE, -150 + i);
+    writer.putUInt(SENSOR_HUMIDITY, 4530);
+    writer.putUInt(SENSOR_PRESSURE, 101325);
+    writer.putUInt(SENSOR_VOLTAGE, 3300);
+  }
+
+  return writer.length();
+}
+
+uint32_t decodeStruct(const uint8_t *buf, uint8_t len) {
+  const payload_t *records = (const payload_t*)buf;
+  uint32_t sum = 0;
+
+  for (uint8_t i = 0; i < len / sizeof(payload_t); ++i) {
+    payload_t record;
+
+    memcpy(&record, &records[i], sizeof(record)); // Like gateway does into its frame ring
+    sum += record.id + record.uptime;
+  }
+
+  return sum;
+}
+
+uint32_t decodeTlv(const uint8_t *buf, uint8_t len) {
+  TlvView view(buf, len);
+  tlv_item_t item;
+  uint32_t sum = 0;
+
+  while (view.next(item)) {
+    sum += item.value;
+  }
+
+  return sum;
+}
+
+void compare(uint8_t readings) {
+  uint8_t buf[MAX_DATA];
+  uint8_t struct_len, tlv_len;
+  double struct_ns, tlv_ns;
+
+  struct_len = encodeStruct(buf, readings);
+  struct_ns = benchNs([&]() { benchSink += decodeStruct(buf, struct_len); });
+  tlv_len = encodeTlv(buf, readings);
+  tlv_ns = benchNs([&]() { benchSink += decodeTlv(buf, tlv_len); });
+  printf("%2u readings:   struct %3u bytes, decode %7.1f ns. | TLV %3u bytes, decode %7.1f ns.",
+    readings, HEADER_SIZE + struct_len, struct_ns, HEADER_SIZE + tlv_len, tlv_ns);
+  tlv_ns = benchNs([&]() { benchSink += encodeTlv(buf, readings); });
+  printf(", encode %7.1f ns.\n", tlv_ns);
+}
+
+}
+
+void benchTlv() {
+  uint8_t buf[MAX_DATA];
+  uint8_t len;
+
+  compare(1);
+  compare(6);
+  compare(30);
+
+  len = encodeSensorsTlv(buf, 1);
+  printf(" 1 x 5 sensors: struct %3u bytes                      | TLV %3u bytes, decode %7.1f ns.\n",
+    (unsigned)(HEADER_SIZE + sizeof(sensors_t)), HEADER_SIZE + len, benchNs([&]() { benchSink += decodeTlv(buf, len); }));
+  len = encodeSensorsTlv(buf, 6);
+  printf(" 6 x 5 sensors: struct %3u bytes                      | TLV %3u bytes, decode %7.1f ns.\n",
+    (unsigned)(HEADER_SIZE + 6 * sizeof(sensors_t)), HEADER_SIZE + len, benchNs([&]() { benchSink += decodeTlv(buf, len); }));
+}
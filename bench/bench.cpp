@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Bench.h"
+
+/*
+ * Host microbenchmarks of the gateway and client hot paths, run all or the ones
+ * named on command line.
+ */
+
+volatile uint32_t benchSink;
+volatile uint64_t benchAllocs;
+
+// Counting wrappers of glibc allocator, operator new ends up here too
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+  ++benchAllocs;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  ++benchAllocs;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  ++benchAllocs;
+  return __libc_realloc(ptr, size);
+}
+}
+
+static const struct {
+  const char *name;
+  void (*run)();
+} BENCHES[] = {
+  { "tlv", benchTlv },
+  { "flashlog", benchFlashLog },
+  { "containers", benchContainers },
+  { "gateway", benchGateway },
+};
+
+int main(int argc, char *argv[]) {
+  for (uint8_t i = 0; i < sizeof(BENCHES) / sizeof(BENCHES[0]); ++i) {
+    bool selected = argc < 2;
+
+    for (int j = 1; j < argc; ++j) {
+      if (! strcmp(argv[j], BENCHES[i].name))
+        selected = true;
+    }
+    if (selected) {
+      printf("=== %s ===\n", BENCHES[i].name);
+      BENCHES[i].run();
+    }
+  }
+
+  return 0;
+}
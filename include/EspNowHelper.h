@@ -3,10 +3,33 @@
 
 #include <inttypes.h>
 #include <espnow.h>
+#include "SpscRing.h"
+
+struct __packed espnow_probe_t { // Server discovery, broadcasted by client and answered by server
+  uint8_t magic[3]; // "EN?" in probe, "EN!" in reply
+  uint8_t channel; // Of server, 0 in probe
+  uint8_t mac[6]; // To address server, all 0 in probe
+  uint8_t load; // Of server, 0 (idle) .. 255 (full)
+};
+
+struct __packed espnow_server_t { // Discovered server
+  uint8_t mac[6];
+  uint8_t channel;
+  int8_t rssi; // dB, 0 if unknown
+  uint8_t load; // As advertised, ESPNOW_LOAD_UNKNOWN if found by scan
+};
+
+static const uint8_t ESPNOW_LOAD_UNKNOWN = 128;
 
 class EspNowGeneric {
 public:
-  EspNowGeneric(uint8_t channel = 0, esp_now_role role = ESP_NOW_ROLE_COMBO) : _channel(channel), _role(role), _sendError(false), _sended(false), _received(false) {
+  static const uint8_t MAX_DATA_LEN = 250;
+  static const uint8_t MAX_ASYNC = 4; // Queued asynchronous sends
+  static const uint32_t ASYNC_MIN_TIMEOUT = 4; // 4 ms., MAC layer retries of unicast
+  static const uint32_t ASYNC_LOST = 100; // 100 ms., late callback is not expected anymore
+
+  EspNowGeneric(uint8_t channel = 0, esp_now_role role = ESP_NOW_ROLE_COMBO) : _channel(channel), _role(role), _sendError(false), _sended(false), _received(false),
+    _async_head(0), _async_count(0), _async_handle(0), _async_timeouts(0), _async_late(0), _async_timed_out(0) {
     _this = this;
   }
   virtual ~EspNowGeneric() {
@@ -16,6 +39,9 @@ public:
   virtual bool begin();
   virtual void end();
 
+  uint8_t channel() const {
+    return _channel;
+  }
   bool setMasterKey(const uint8_t *key, uint8_t keylen);
 
   uint8_t peerCount() const;
@@ -30,7 +56,14 @@ public:
     return send(NULL, data, len);
   }
   bool sendBroadcast(const uint8_t *data, uint8_t len);
-  bool sendReliable(const uint8_t *mac, const uint8_t *data, uint8_t len, uint8_t repeat = 1, uint32_t timeout = 1);
+  // timeout 0 is derived from frame airtime, see sendTimeout()
+  bool sendReliable(const uint8_t *mac, const uint8_t *data, uint8_t len, uint8_t repeat = 1, uint32_t timeout = 0);
+  // Returns handle (0 if queue is full), completion is reported by onSendDone(), don't mix with blocking sends
+  uint8_t sendAsync(const uint8_t *mac, const uint8_t *data, uint8_t len, uint8_t repeat = 1, uint32_t timeout = 0);
+  virtual void poll(); // Call from loop() to move asynchronous sends forward
+  uint8_t asyncPending() const {
+    return _async_count;
+  }
 
   bool sendError() const {
     return _sendError;
@@ -49,7 +82,14 @@ protected:
   virtual void onSend(const uint8_t *mac, bool error) {
     _sendError = error;
     _sended = true;
+    if (_async_late != _async_timeouts) { // Late callback of a send given up by poll(), not of the head
+      ++_async_late;
+      return;
+    }
+    if (_async_count && (_async[_async_head].state == ASYNC_SENDING))
+      _async[_async_head].state = error ? ASYNC_ERROR : ASYNC_SENT;
   }
+  virtual void onSendDone(uint8_t handle, const uint8_t *mac, bool success) {}
 
   static void _onReceive(uint8_t *mac, uint8_t *data, uint8_t len) {
     _this->onReceive(mac, data, len);
@@ -57,6 +97,22 @@ protected:
   static void _onSend(uint8_t *mac, uint8_t status) {
     _this->onSend(mac, status != 0);
   }
+  static uint32_t sendTimeout(uint8_t len) { // ms., frame at 1 Mbps (125 bytes per ms.) plus MAC retries
+    return ASYNC_MIN_TIMEOUT + (len + 124) / 125;
+  }
+
+  enum async_state_t : uint8_t { ASYNC_QUEUED, ASYNC_SENDING, ASYNC_SENT, ASYNC_ERROR };
+
+  struct __packed async_send_t {
+    uint8_t mac[6];
+    uint8_t data[MAX_DATA_LEN];
+    uint8_t len;
+    uint8_t handle;
+    uint8_t repeat;
+    volatile async_state_t state;
+    uint32_t timeout;
+    uint32_t start;
+  };
 
   static EspNowGeneric *_this;
   uint8_t _channel : 4;
@@ -64,14 +120,62 @@ protected:
   volatile bool _sendError : 1;
   volatile bool _sended : 1;
   volatile bool _received : 1;
+  async_send_t _async[MAX_ASYNC]; // FIFO, only the head is on air
+  uint8_t _async_head;
+  uint8_t _async_count;
+  uint8_t _async_handle;
+  volatile uint8_t _async_timeouts; // Sends given up without callback, written by poll() only
+  volatile uint8_t _async_late; // Their callbacks arrived since, written by onSend() only
+  uint32_t _async_timed_out; // millis() of last given up send
 };
 
 class EspNowServer : public EspNowGeneric {
 public:
-  EspNowServer(uint8_t channel = 0) : EspNowGeneric(channel) {}
+  static const uint8_t MAX_PEER_SLOTS = 16; // SDK allows up to 20 peers
+
+  EspNowServer(uint8_t channel = 0) : EspNowGeneric(channel), _slot_count(0), _slot_tick(0), _evictions(0), _probe_next(0), _load(0) {
+    memset(_probe_handles, 0, sizeof(_probe_handles));
+  }
 
   bool begin();
   void end();
+  bool setChannel(uint8_t channel); // Restarts SDK and soft AP only if channel differs, state of derived classes survives
+  void poll(); // Also answers discovery probe
+  void setLoad(uint8_t load) { // Advertised to probing clients
+    _load = load;
+  }
+
+  bool usePeer(const uint8_t *mac, esp_now_role role = ESP_NOW_ROLE_CONTROLLER);
+  uint32_t evictions() const {
+    return _evictions;
+  }
+  uint32_t probeDrops() const { // Probes not answered as MAX_ASYNC others were waiting, their clients repeat them
+    return _probes.overflows();
+  }
+
+protected:
+  void onReceive(const uint8_t *mac, const uint8_t *data, uint8_t len);
+
+  bool isProbe(const uint8_t *mac, const uint8_t *data, uint8_t len); // Queues sender to answer from poll()
+  bool isProbeReply(uint8_t handle) const; // So onSendDone() can tell discovery replies from application frames
+
+  struct __packed peer_slot_t {
+    uint8_t mac[6];
+    uint32_t used;
+  };
+
+  peer_slot_t _slots[MAX_PEER_SLOTS];
+  uint8_t _slot_count;
+  uint32_t _slot_tick;
+  uint32_t _evictions;
+  struct __packed probe_t {
+    uint8_t mac[6];
+  };
+
+  SpscRing<probe_t, MAX_ASYNC> _probes; // Senders waiting for reply
+  uint8_t _probe_handles[MAX_ASYNC]; // Of last replies, no more of them can be on air
+  uint8_t _probe_next;
+  uint8_t _load;
 };
 
 class EspNowClient : public EspNowGeneric {
@@ -82,11 +186,22 @@ public:
   }
 
   bool begin();
+  bool setServer(uint8_t channel, const uint8_t *mac); // Fail over to another server, object state survives
 
 protected:
   uint8_t _server_mac[6];
 };
 
-int8_t espNowFindServer(uint8_t *mac = NULL, int8_t *rssi = NULL);
+/*
+ * Server discovery. Broadcast probe on last known channel first, then on all others, scan of soft AP if nobody
+ * answers (older server). RSSI of probed servers is read from RxControl the SDK keeps in front of received reply,
+ * their channels are scanned only if it is unknown and more than one answered. Servers are ranked by RSSI lowered
+ * by their load, best first.
+ */
+uint8_t espNowFindServers(espnow_server_t *servers, uint8_t max, uint8_t channel = 0); // Count of found
+int8_t espNowFindServer(uint8_t *mac = NULL, int8_t *rssi = NULL, uint8_t channel = 0); // Channel of best one, 0 if none
+uint8_t espNowProbeServers(espnow_server_t *servers, uint8_t max, uint8_t channel = 0); // Probe only, unranked
+uint8_t espNowScanServers(espnow_server_t *servers, uint8_t max, uint8_t channel = 0); // Scan only, unranked
+int16_t espNowServerScore(const espnow_server_t *server);
 
 #endif
@@ -0,0 +1,63 @@
+#ifndef __FLASHLOG_H
+#define __FLASHLOG_H
+
+#include <inttypes.h>
+#include "LogStorage.h"
+
+/*
+ * Append-only ring log of small records over LogStorage. Storage is split into
+ * equal slots, first one keeps the read position, the others records framed by
+ * header with sequence number and CRC-16. Record of sequence number seq lives in
+ * slot 1 + seq % capacity(), so begin() finds the newest one by scanning and torn
+ * or stale slots are skipped. When full, the oldest record is overwritten.
+ */
+class FlashLog {
+public:
+  struct __attribute__((packed)) header_t {
+    uint8_t magic;
+    uint8_t len;
+    uint16_t crc; // CRC-16/CCITT of len, seq and data
+    uint32_t seq;
+  };
+
+  static const uint8_t MAX_SLOT = 64;
+  static const uint8_t MAX_RECORD = MAX_SLOT - sizeof(header_t);
+
+  FlashLog(LogStorage *storage, uint8_t slot_size) : _storage(storage), _slot(slot_size), _capacity(0), _head(0), _tail(0),
+    _committed(0), _lost(0), _dirty(false) {}
+
+  bool begin(); // false if storage is not available
+  uint32_t capacity() const {
+    return _capacity;
+  }
+  uint32_t count() const {
+    return _tail - _head;
+  }
+  uint32_t lost() const { // Overwritten unread or corrupted records
+    return _lost;
+  }
+  bool append(const void *data, uint8_t len);
+  uint8_t peek(void *data); // Oldest record length, 0 if log is empty
+  void pop();
+  bool commit(); // Persist read position and flush appends
+
+  static uint16_t crc16(const void *data, uint16_t len, uint16_t crc = 0xFFFF);
+
+protected:
+  static const uint8_t MAGIC_RECORD = 0xA5;
+  static const uint8_t MAGIC_HEAD = 0x5A;
+
+  bool readSlot(uint32_t slot, header_t *header, uint8_t *data);
+  bool writeSlot(uint32_t slot, uint8_t magic, uint32_t seq, const void *data, uint8_t len);
+
+  LogStorage *_storage;
+  uint8_t _slot;
+  uint32_t _capacity;
+  uint32_t _head; // Oldest unread sequence number
+  uint32_t _tail; // Next to append
+  uint32_t _committed; // _head as persisted
+  uint32_t _lost;
+  bool _dirty;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef __HISTOGRAM_H
+#define __HISTOGRAM_H
+
+#include <inttypes.h>
+#include <string.h>
+
+/*
+ * Fixed bucket log2 histogram, bucket N counts values from 2^(N-1) to 2^N - 1 and
+ * bucket 0 counts zeros. add() is a few instructions without division, so it fits
+ * hot paths. Percentiles are bucket upper bounds (within factor of 2), capped by
+ * exact maximum.
+ */
+class Log2Histogram {
+public:
+  static const uint8_t BUCKETS = 33;
+
+  Log2Histogram() {
+    clear();
+  }
+
+  void add(uint32_t value) {
+    ++_buckets[value ? 32 - __builtin_clz(value) : 0];
+    ++_count;
+    if (value > _max)
+      _max = value;
+  }
+  void clear() {
+    memset(_buckets, 0, sizeof(_buckets));
+    _count = 0;
+    _max = 0;
+  }
+  uint32_t count() const {
+    return _count;
+  }
+  uint32_t max() const {
+    return _max;
+  }
+  uint32_t percentile(uint8_t p) const { // p in %, 0 if empty
+    uint32_t rank = ((uint64_t)_count * p + 99) / 100;
+    uint32_t seen = 0;
+
+    if (! rank)
+      rank = 1;
+    for (uint8_t i = 0; i < BUCKETS; ++i) {
+      seen += _buckets[i];
+      if (seen >= rank) {
+        uint32_t upper = i < 32 ? (1UL << i) - 1 : 0xFFFFFFFF;
+
+        return upper < _max ? upper : _max;
+      }
+    }
+
+    return _max;
+  }
+
+protected:
+  uint32_t _buckets[BUCKETS];
+  uint32_t _count;
+  uint32_t _max;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __LOGSTORAGE_H
+#define __LOGSTORAGE_H
+
+#include <inttypes.h>
+#ifdef ARDUINO
+#include <LittleFS.h>
+#else
+#include <stdio.h>
+#endif
+
+/*
+ * Fixed size random access region FlashLog lives in.
+ */
+class LogStorage {
+public:
+  virtual ~LogStorage() {}
+
+  virtual bool begin() = 0; // Region is zero filled when created
+  virtual void end() {}
+  virtual uint32_t size() const = 0;
+  virtual bool read(uint32_t offset, void *data, uint16_t len) = 0;
+  virtual bool write(uint32_t offset, const void *data, uint16_t len) = 0;
+  virtual bool flush() = 0; // Make writes durable
+};
+
+/*
+ * One preallocated file on flash (LittleFS) or, on host, in current directory as
+ * if it was the file system root.
+ */
+class FileLogStorage : public LogStorage {
+public:
+  FileLogStorage(const char *path, uint32_t size) : _path(path), _size(size) {
+#ifndef ARDUINO
+    _file = NULL;
+#endif
+  }
+  ~FileLogStorage() {
+    end();
+  }
+
+  bool begin();
+  void end();
+  uint32_t size() const {
+    return _size;
+  }
+  bool read(uint32_t offset, void *data, uint16_t len);
+  bool write(uint32_t offset, const void *data, uint16_t len);
+  bool flush();
+
+protected:
+  const char *_path;
+  uint32_t _size;
+#ifdef ARDUINO
+  File _file;
+#else
+  FILE *_file;
+#endif
+};
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef __PEERTABLE_H
+#define __PEERTABLE_H
+
+#include <inttypes.h>
+#include <string.h>
+
+/*
+ * Open addressing (linear probing) hash table of peers keyed by 6 byte MAC.
+ * T must start with "uint8_t mac[6]", all-zero MAC marks an empty slot.
+ * MAX_SIZE must be a power of two, at most 3/4 of slots are filled.
+ */
+template <class T, uint16_t MAX_SIZE = 128>
+class PeerTable {
+public:
+  static const uint16_t ERR_INDEX = 0xFFFF;
+
+  PeerTable() {
+    static_assert((MAX_SIZE & (MAX_SIZE - 1)) == 0, "MAX_SIZE must be a power of two");
+    clear();
+  }
+
+  uint16_t count() const {
+    return _count;
+  }
+  static uint16_t capacity() {
+    return MAX_SIZE - MAX_SIZE / 4;
+  }
+  void clear() {
+    memset(_items, 0, sizeof(_items));
+    _count = 0;
+  }
+  T *find(const uint8_t *mac);
+  T *add(const uint8_t *mac);
+  bool remove(const uint8_t *mac);
+
+  // Slot access for iteration over [0, MAX_SIZE)
+  static uint16_t size() {
+    return MAX_SIZE;
+  }
+  bool used(uint16_t index) const {
+    return ! isEmpty(_items[index].mac);
+  }
+  T &operator[](uint16_t index) {
+    return _items[index];
+  }
+
+protected:
+  static uint16_t hash(const uint8_t *mac) {
+    // First 3 bytes are mostly the same vendor OUI
+    uint32_t h = ((uint32_t)mac[2] << 24) | ((uint32_t)mac[3] << 16) | (mac[4] << 8) | mac[5];
+
+    h ^= (uint32_t)mac[0] << 8 | mac[1];
+    h *= 0x9E3779B1;
+
+    return (h >> 16) & (MAX_SIZE - 1);
+  }
+  static bool isEmpty(const uint8_t *mac) {
+    return ! (mac[0] | mac[1] | mac[2] | mac[3] | mac[4] | mac[5]);
+  }
+  uint16_t indexOf(const uint8_t *mac) const;
+
+  T _items[MAX_SIZE];
+  uint16_t _count;
+};
+
+template <class T, uint16_t MAX_SIZE>
+uint16_t PeerTable<T, MAX_SIZE>::indexOf(const uint8_t *mac) const {
+  uint16_t i = hash(mac);
+
+  while (! isEmpty(_items[i].mac)) {
+    if (! memcmp(_items[i].mac, mac, sizeof(_items[i].mac)))
+      return i;
+    i = (i + 1) & (MAX_SIZE - 1);
+  }
+
+  return ERR_INDEX;
+}
+
+template <class T, uint16_t MAX_SIZE>
+T *PeerTable<T, MAX_SIZE>::find(const uint8_t *mac) {
+  uint16_t i = indexOf(mac);
+
+  return i != ERR_INDEX ? &_items[i] : NULL;
+}
+
+template <class T, uint16_t MAX_SIZE>
+T *PeerTable<T, MAX_SIZE>::add(const uint8_t *mac) {
+  uint16_t i = hash(mac);
+
+  if (isEmpty(mac))
+    return NULL;
+  while (! isEmpty(_items[i].mac)) {
+    if (! memcmp(_items[i].mac, mac, sizeof(_items[i].mac)))
+      return &_items[i];
+    i = (i + 1) & (MAX_SIZE - 1);
+  }
+  if (_count >= capacity())
+    return NULL;
+  memset(&_items[i], 0, sizeof(T));
+  memcpy(_items[i].mac, mac, sizeof(_items[i].mac));
+  ++_count;
+
+  return &_items[i];
+}
+
+template <class T, uint16_t MAX_SIZE>
+bool PeerTable<T, MAX_SIZE>::remove(const uint8_t *mac) {
+  uint16_t i = indexOf(mac);
+
+  if (i == ERR_INDEX)
+    return false;
+  // Backward shift deletion keeps probe chains intact without tombstones
+  for (uint16_t j = (i + 1) & (MAX_SIZE - 1); ! isEmpty(_items[j].mac); j = (j + 1) & (MAX_SIZE - 1)) {
+    uint16_t home = hash(_items[j].mac);
+
+    if (((j - home) & (MAX_SIZE - 1)) >= ((j - i) & (MAX_SIZE - 1))) {
+      memcpy(&_items[i], &_items[j], sizeof(T));
+      i = j;
+    }
+  }
+  memset(&_items[i], 0, sizeof(T));
+  --_count;
+
+  return true;
+}
+
+#endif
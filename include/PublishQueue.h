@@ -0,0 +1,94 @@
+#ifndef __PUBLISHQUEUE_H
+#define __PUBLISHQUEUE_H
+
+#include <inttypes.h>
+#include <string.h>
+
+enum queue_policy_t : uint8_t { QUEUE_DROP_OLDEST, QUEUE_DROP_NEWEST };
+
+/*
+ * Bounded FIFO of pending publishes. T must start with KEY_SIZE bytes of its
+ * coalescing key. Only above high watermark putting an item with the key of a
+ * queued one just replaces that one (latest value wins), below it every item is
+ * kept. When full, oldest or new item is dropped. throttled() is set at high
+ * watermark and cleared at low one.
+ */
+template <class T, uint8_t KEY_SIZE, uint8_t MAX_SIZE = 64>
+class PublishQueue {
+public:
+  PublishQueue(queue_policy_t policy = QUEUE_DROP_OLDEST, uint8_t high = MAX_SIZE - MAX_SIZE / 4, uint8_t low = MAX_SIZE / 4) :
+    _policy(policy), _high(high), _low(low) {
+    clear();
+  }
+
+  uint8_t count() const {
+    return _count;
+  }
+  bool throttled() const {
+    return _throttled;
+  }
+  uint32_t coalesced() const {
+    return _coalesced;
+  }
+  uint32_t dropped() const {
+    return _dropped;
+  }
+  void clear() {
+    _head = 0;
+    _count = 0;
+    _throttled = false;
+    _coalesced = 0;
+    _dropped = 0;
+  }
+  bool put(const T &t); // false if t was dropped
+  T *peek() {
+    return _count ? &_items[_head] : NULL;
+  }
+  void pop();
+
+protected:
+  T _items[MAX_SIZE];
+  queue_policy_t _policy;
+  uint8_t _high;
+  uint8_t _low;
+  uint8_t _head;
+  uint8_t _count;
+  bool _throttled;
+  uint32_t _coalesced;
+  uint32_t _dropped;
+};
+
+template <class T, uint8_t KEY_SIZE, uint8_t MAX_SIZE>
+bool PublishQueue<T, KEY_SIZE, MAX_SIZE>::put(const T &t) {
+  for (uint8_t i = 0; (_count >= _high) && (i < _count); ++i) {
+    T *item = &_items[(_head + i) % MAX_SIZE];
+
+    if (! memcmp(item, &t, KEY_SIZE)) {
+      memcpy(item, &t, sizeof(T));
+      ++_coalesced;
+      return true;
+    }
+  }
+  if (_count >= MAX_SIZE) {
+    ++_dropped;
+    if (_policy == QUEUE_DROP_NEWEST)
+      return false;
+    pop();
+  }
+  memcpy(&_items[(_head + _count) % MAX_SIZE], &t, sizeof(T));
+  if (++_count >= _high)
+    _throttled = true;
+
+  return true;
+}
+
+template <class T, uint8_t KEY_SIZE, uint8_t MAX_SIZE>
+void PublishQueue<T, KEY_SIZE, MAX_SIZE>::pop() {
+  if (_count) {
+    _head = (_head + 1) % MAX_SIZE;
+    if (--_count <= _low)
+      _throttled = false;
+  }
+}
+
+#endif
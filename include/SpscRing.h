@@ -0,0 +1,78 @@
+#ifndef __SPSCRING_H
+#define __SPSCRING_H
+
+#include <inttypes.h>
+#include <string.h>
+#include <atomic>
+
+/*
+ * Lock-free single producer (ESP-NOW callback) / single consumer (loop()) ring.
+ * MAX_SIZE must be a power of two, head and tail only grow and are masked on access.
+ */
+template <class T, uint8_t MAX_SIZE = 32>
+class SpscRing {
+public:
+  SpscRing() : _head(0), _tail(0), _overflows(0) {
+    static_assert((MAX_SIZE & (MAX_SIZE - 1)) == 0, "MAX_SIZE must be a power of two");
+  }
+
+  uint8_t depth() const {
+    return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+  }
+  uint32_t overflows() const {
+    return _overflows.load(std::memory_order_relaxed);
+  }
+  bool put(const T &t);
+  bool put(const T *t, uint8_t count); // All or nothing, counted as one overflow
+  bool get(T &t);
+
+protected:
+  T _items[MAX_SIZE];
+  std::atomic<uint32_t> _head; // Written by producer only
+  std::atomic<uint32_t> _tail; // Written by consumer only
+  std::atomic<uint32_t> _overflows; // Written by producer only
+};
+
+template <class T, uint8_t MAX_SIZE>
+bool SpscRing<T, MAX_SIZE>::put(const T &t) {
+  uint32_t head = _head.load(std::memory_order_relaxed);
+
+  if (head - _tail.load(std::memory_order_acquire) >= MAX_SIZE) {
+    _overflows.store(_overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return false;
+  }
+  memcpy(&_items[head & (MAX_SIZE - 1)], &t, sizeof(T));
+  _head.store(head + 1, std::memory_order_release);
+
+  return true;
+}
+
+template <class T, uint8_t MAX_SIZE>
+bool SpscRing<T, MAX_SIZE>::put(const T *t, uint8_t count) {
+  uint32_t head = _head.load(std::memory_order_relaxed);
+
+  if (head - _tail.load(std::memory_order_acquire) + count > MAX_SIZE) {
+    _overflows.store(_overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return false;
+  }
+  for (uint8_t i = 0; i < count; ++i) {
+    memcpy(&_items[(head + i) & (MAX_SIZE - 1)], &t[i], sizeof(T));
+  }
+  _head.store(head + count, std::memory_order_release); // Consumer sees the whole batch at once
+
+  return true;
+}
+
+template <class T, uint8_t MAX_SIZE>
+bool SpscRing<T, MAX_SIZE>::get(T &t) {
+  uint32_t tail = _tail.load(std::memory_order_relaxed);
+
+  if (tail == _head.load(std::memory_order_acquire))
+    return false;
+  memcpy(&t, &_items[tail & (MAX_SIZE - 1)], sizeof(T));
+  _tail.store(tail + 1, std::memory_order_release);
+
+  return true;
+}
+
+#endif
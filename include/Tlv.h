@@ -0,0 +1,78 @@
+#ifndef __TLV_H
+#define __TLV_H
+
+#include <inttypes.h>
+
+/*
+ * Self-describing payload: sequence of items, each is a tag byte (key << 3 | wire type)
+ * followed by value. Integers are varints (7 bits per byte, LSB first), signed ones are
+ * zigzag coded so small negative numbers stay short too.
+ */
+enum tlv_wire_t : uint8_t { TLV_UINT, TLV_SINT, TLV_BYTES };
+
+static const uint8_t TLV_MAX_KEY = 31;
+
+struct tlv_item_t {
+  uint8_t key;
+  tlv_wire_t wire;
+  uint32_t value; // TLV_UINT or TLV_SINT (cast to int32_t), length for TLV_BYTES
+  const uint8_t *data; // TLV_BYTES only, points into decoded buffer
+};
+
+class TlvWriter {
+public:
+  TlvWriter(uint8_t *buf, uint8_t size) : _buf(buf), _size(size), _len(0) {}
+
+  uint8_t length() const {
+    return _len;
+  }
+  void clear() {
+    _len = 0;
+  }
+  // On overflow nothing is written and false is returned
+  bool putUInt(uint8_t key, uint32_t value) {
+    return putVarint(key, TLV_UINT, value);
+  }
+  bool putSInt(uint8_t key, int32_t value) {
+    return putVarint(key, TLV_SINT, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+  }
+  bool putBytes(uint8_t key, const uint8_t *data, uint8_t len);
+
+  static uint8_t varintSize(uint32_t value);
+
+protected:
+  bool putVarint(uint8_t key, tlv_wire_t wire, uint32_t value);
+
+  uint8_t *_buf;
+  uint8_t _size;
+  uint8_t _len;
+};
+
+// Zero copy decoder over received buffer, which must outlive it
+class TlvView {
+public:
+  TlvView(const uint8_t *data, uint8_t len) : _data(data), _len(len), _pos(0), _error(false) {}
+
+  bool next(tlv_item_t &item); // false at end or on malformed input
+  bool error() const {
+    return _error;
+  }
+  void rewind() {
+    _pos = 0;
+    _error = false;
+  }
+
+  static int32_t toSInt(uint32_t value) { // Of TLV_SINT item
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 0x01);
+  }
+
+protected:
+  bool getVarint(uint32_t &value);
+
+  const uint8_t *_data;
+  uint8_t _len;
+  uint8_t _pos;
+  bool _error;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <inttypes.h>
+#include <string.h>
+#include "SpscRing.h"
+
+/*
+ * Deferred trace of fixed size binary records. Hot paths (ESP-NOW callbacks) only
+ * copy event, MAC and leading bytes of frame into RAM ring, loop() formats and
+ * prints them later. Records above TRACE_LEVEL compile out to nothing, so does the
+ * whole ring with TRACE_NONE.
+ */
+#define TRACE_NONE 0
+#define TRACE_ERROR 1
+#define TRACE_INFO 2
+#define TRACE_DEBUG 3
+
+#ifndef TRACE_LEVEL // Build flag
+#define TRACE_LEVEL TRACE_DEBUG
+#endif
+
+static const uint8_t TRACE_DATA = 8; // Leading bytes of frame kept
+
+struct __attribute__((packed)) trace_t {
+  uint8_t event; // Application defined
+  uint8_t len; // Of whole data, only first TRACE_DATA bytes are kept
+  uint8_t mac[6];
+  uint8_t data[TRACE_DATA];
+};
+
+template <uint8_t MAX_SIZE = 32>
+class TraceRing {
+public:
+  bool put(uint8_t event, const uint8_t *mac = NULL, const void *data = NULL, uint8_t len = 0) { // false if ring is full
+    trace_t t;
+
+    t.event = event;
+    t.len = len;
+    if (mac)
+      memcpy(t.mac, mac, sizeof(t.mac));
+    else
+      memset(t.mac, 0, sizeof(t.mac));
+    if (data)
+      memcpy(t.data, data, len < TRACE_DATA ? len : TRACE_DATA);
+    return _ring.put(t);
+  }
+  bool get(trace_t &t) {
+    return _ring.get(t);
+  }
+  uint32_t lost() const {
+    return _ring.overflows();
+  }
+
+protected:
+  SpscRing<trace_t, MAX_SIZE> _ring;
+};
+
+#if TRACE_LEVEL >= TRACE_ERROR
+#define TRACE_E(ring, ...) (ring).put(__VA_ARGS__)
+#else
+#define TRACE_E(ring, ...) do {} while (0)
+#endif
+#if TRACE_LEVEL >= TRACE_INFO
+#define TRACE_I(ring, ...) (ring).put(__VA_ARGS__)
+#else
+#define TRACE_I(ring, ...) do {} while (0)
+#endif
+#if TRACE_LEVEL >= TRACE_DEBUG
+#define TRACE_D(ring, ...) (ring).put(__VA_ARGS__)
+#else
+#define TRACE_D(ring, ...) do {} while (0)
+#endif
+
+#endif
@@ -49,20 +49,20 @@ void setup() {
 }
 
 void loop() {
-  event_t *event;
+  event_t event;
 
-  while ((event = (event_t*)events->get()) != NULL) {
-    if (event->id >= EVT_BTNCLICK) {
+  while (events->get(event)) {
+    if (event.id >= EVT_BTNCLICK) {
       Serial.print(F("Button #"));
-      Serial.print(event->data + 1);
+      Serial.print(event.data + 1);
     }
-    if (event->id == EVT_BTNCLICK) { // Next led mode
+    if (event.id == EVT_BTNCLICK) { // Next led mode
       ledmode_t ledmode;
 
 #ifdef ONE_LED
       ledmode = led->getMode();
 #else
-      ledmode = leds->getMode(event->data);
+      ledmode = leds->getMode(event.data);
 #endif
       if (ledmode < LED_FADEINOUT)
         *((uint8_t*)&ledmode) += 1;
@@ -71,16 +71,16 @@ void loop() {
 #ifdef ONE_LED
       led->setMode(ledmode);
 #else
-      leds->setMode(event->data, ledmode);
+      leds->setMode(event.data, ledmode);
 #endif
       Serial.println(F(" clicked"));
-    } else if (event->id == EVT_BTNLONGCLICK) { // Previous led mode
+    } else if (event.id == EVT_BTNLONGCLICK) { // Previous led mode
       ledmode_t ledmode;
 
 #ifdef ONE_LED
       ledmode = led->getMode();
 #else
-      ledmode = leds->getMode(event->data);
+      ledmode = leds->getMode(event.data);
 #endif
       if (ledmode > LED_OFF)
         *((uint8_t*)&ledmode) -= 1;
@@ -89,14 +89,14 @@ void loop() {
 #ifdef ONE_LED
       led->setMode(ledmode);
 #else
-      leds->setMode(event->data, ledmode);
+      leds->setMode(event.data, ledmode);
 #endif
       Serial.println(F(" long clicked"));
-    } else if (event->id == EVT_BTNDBLCLICK) { // First led mode (off)
+    } else if (event.id == EVT_BTNDBLCLICK) { // First led mode (off)
 #ifdef ONE_LED
       led->setMode(LED_OFF);
 #else
-      leds->setMode(event->data, LED_OFF);
+      leds->setMode(event.data, LED_OFF);
 #endif
       Serial.println(F(" double clicked"));
     }
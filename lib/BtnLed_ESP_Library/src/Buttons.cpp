@@ -78,7 +78,7 @@ void Button::onChange(buttonstate_t state) {
 
     e.id = EVT_BTNBASE + state;
     e.data = 0;
-    _events->put(&e, true);
+    _events->put(&e); // Newest event is dropped if queue is full
   }
 }
 
@@ -214,6 +214,6 @@ void Buttons::onChange(buttonstate_t state, uint8_t button) {
 
     e.id = EVT_BTNBASE + state;
     e.data = button;
-    _events->put(&e, true);
+    _events->put(&e); // Newest event is dropped if queue is full
   }
 }
@@ -10,6 +10,6 @@ struct __packed event_t {
   payload_t data;
 };
 
-typedef Queue<event_t, 32> EventQueue;
+typedef SpscQueue<event_t, 32> EventQueue; // Filled from button ISRs
 
 #endif
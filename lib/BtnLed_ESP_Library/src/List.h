@@ -5,12 +5,22 @@
 #include <stdlib.h>
 #include <string.h>
 
+/*
+ * Storage of List grows by doubling of capacity (starting from LIST_MIN_CAPACITY,
+ * up to MAX_SIZE), remove() keeps it, clear() and shrink_to_fit() give it back.
+ * Optional allocator hook has realloc() semantics (NULL ptr allocates, size 0 frees),
+ * so items can be drawn from a static pool instead of heap.
+ */
+typedef void *(*list_alloc_t)(void *ptr, size_t size);
+
+static const uint8_t LIST_MIN_CAPACITY = 4;
+
 template <class T, uint8_t MAX_SIZE = 255>
 class List {
 public:
   static const uint8_t ERR_INDEX = 0xFF;
 
-  List() : _count(0), _items(NULL) {}
+  List(list_alloc_t alloc = NULL) : _count(0), _capacity(0), _items(NULL), _alloc(alloc) {}
   virtual ~List() {
     clear();
   }
@@ -18,7 +28,12 @@ public:
   uint8_t count() const {
     return _count;
   }
+  uint8_t capacity() const {
+    return _capacity;
+  }
   void clear();
+  bool reserve(uint8_t capacity); // false if out of memory
+  void shrink_to_fit();
   uint8_t add(const T &t);
   void remove(uint8_t index);
   uint8_t find(const T &t);
@@ -32,10 +47,13 @@ public:
 protected:
   virtual void cleanup(void *ptr) {}
   virtual bool match(uint8_t index, const void *t);
+  bool resize(uint8_t capacity);
 
   struct __packed {
     uint8_t _count;
+    uint8_t _capacity;
     T *_items;
+    list_alloc_t _alloc;
   };
 };
 
@@ -83,31 +101,61 @@ void List<T, MAX_SIZE>::clear() {
     for (int16_t i = _count - 1; i >= 0; --i) {
       cleanup(&_items[i]);
     }
-    free(_items);
-    _items = NULL;
+    resize(0);
   }
   _count = 0;
 }
 
+template <class T, uint8_t MAX_SIZE>
+bool List<T, MAX_SIZE>::reserve(uint8_t capacity) {
+  if (capacity > MAX_SIZE)
+    capacity = MAX_SIZE;
+
+  return (capacity <= _capacity) || resize(capacity);
+}
+
+template <class T, uint8_t MAX_SIZE>
+void List<T, MAX_SIZE>::shrink_to_fit() {
+  if (_capacity > _count)
+    resize(_count);
+}
+
+template <class T, uint8_t MAX_SIZE>
+bool List<T, MAX_SIZE>::resize(uint8_t capacity) {
+  void *ptr;
+
+  if (! capacity) {
+    if (_alloc)
+      _alloc(_items, 0);
+    else
+      free(_items);
+    ptr = NULL;
+  } else {
+    ptr = _alloc ? _alloc(_items, sizeof(T) * capacity) : realloc(_items, sizeof(T) * capacity);
+    if (! ptr)
+      return false;
+  }
+  _items = (T*)ptr;
+  _capacity = capacity;
+
+  return true;
+}
+
 template <class T, uint8_t MAX_SIZE>
 uint8_t List<T, MAX_SIZE>::add(const T &t) {
   if (_count >= MAX_SIZE)
     return ERR_INDEX;
-  if (_items) {
-    void *ptr = realloc(_items, sizeof(T) * (_count + 1));
-    if (! ptr)
-      return ERR_INDEX;
-    _items = (T*)ptr;
-    ++_count;
-  } else {
-    _items = (T*)malloc(sizeof(T));
-    if (! _items)
+  if (_count >= _capacity) {
+    uint16_t capacity = _capacity < LIST_MIN_CAPACITY ? LIST_MIN_CAPACITY : _capacity * 2;
+
+    if (capacity > MAX_SIZE)
+      capacity = MAX_SIZE;
+    if ((! resize(capacity)) && ((_count + 1 == capacity) || (! resize(_count + 1)))) // Retry without spare room
       return ERR_INDEX;
-    _count = 1;
   }
-  memcpy(&_items[_count - 1], &t, sizeof(T));
+  memcpy(&_items[_count], &t, sizeof(T));
 
-  return _count - 1;
+  return _count++;
 }
 
 template <class T, uint8_t MAX_SIZE>
@@ -117,12 +165,6 @@ void List<T, MAX_SIZE>::remove(uint8_t index) {
     if ((_count > 1) && (index < _count - 1))
       memmove(&_items[index], &_items[index + 1], sizeof(T) * (_count - index - 1));
     --_count;
-    if (_count)
-      _items = (T*)realloc(_items, sizeof(T) * _count);
-    else {
-      free(_items);
-      _items = NULL;
-    }
   }
 }
 
@@ -130,7 +172,7 @@ template <class T, uint8_t MAX_SIZE>
 uint8_t List<T, MAX_SIZE>::find(const T &t) {
   if (_items) {
     for (uint8_t i = 0; i < _count; ++i) {
-      if (match(i, t))
+      if (match(i, &t))
         return i;
     }
   }
@@ -181,7 +223,7 @@ void StaticList<T, MAX_SIZE>::remove(uint8_t index) {
 template <class T, uint8_t MAX_SIZE>
 uint8_t StaticList<T, MAX_SIZE>::find(const T &t) {
   for (uint8_t i = 0; i < _count; ++i) {
-    if (match(i, t))
+    if (match(i, &t))
       return i;
   }
 
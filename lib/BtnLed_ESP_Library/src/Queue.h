@@ -3,6 +3,7 @@
 
 #include <inttypes.h>
 #include <string.h>
+#include <atomic>
 
 template <class T, uint8_t MAX_SIZE = 32>
 class Queue {
@@ -61,4 +62,135 @@ const T *Queue<T, MAX_SIZE>::get() {
     return &_items[_tail + MAX_SIZE - _depth--];
 }
 
+/*
+ * Lock-free variant for single producer (ISR) and single consumer (loop()).
+ * Indexes only grow and are masked on access, so MAX_SIZE must be a power of two.
+ * Items are copied out, full queue drops new items, as producer must not move
+ * consumer's index.
+ */
+template <class T, uint8_t MAX_SIZE = 32>
+class SpscQueue {
+public:
+  SpscQueue() : _head(0), _tail(0), _dropped(0) {
+    static_assert((MAX_SIZE & (MAX_SIZE - 1)) == 0, "MAX_SIZE must be a power of two");
+  }
+
+  uint8_t depth() const {
+    return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+  }
+  uint16_t dropped() const {
+    return _dropped;
+  }
+  void clear() { // By consumer
+    _tail.store(_head.load(std::memory_order_acquire), std::memory_order_release);
+  }
+  bool put(const T *t);
+  uint8_t put_n(const T *t, uint8_t count); // Number of items put, the rest is dropped
+  bool peek(T &t);
+  bool get(T &t);
+  uint8_t get_n(T *t, uint8_t count); // Number of items got
+
+protected:
+  void copyIn(uint8_t head, const T *t, uint8_t count);
+  void copyOut(uint8_t tail, T *t, uint8_t count);
+
+  T _items[MAX_SIZE];
+  std::atomic<uint8_t> _head; // Written by producer only
+  std::atomic<uint8_t> _tail; // Written by consumer only
+  volatile uint16_t _dropped; // Written by producer only
+};
+
+template <class T, uint8_t MAX_SIZE>
+bool SpscQueue<T, MAX_SIZE>::put(const T *t) { // Not put_n(t, 1), copy of known size is much cheaper
+  uint8_t head = _head.load(std::memory_order_relaxed);
+
+  if ((uint8_t)(head - _tail.load(std::memory_order_acquire)) >= MAX_SIZE) {
+    _dropped = _dropped + 1;
+    return false;
+  }
+  memcpy(&_items[head & (MAX_SIZE - 1)], t, sizeof(T));
+  _head.store(head + 1, std::memory_order_release);
+
+  return true;
+}
+
+template <class T, uint8_t MAX_SIZE>
+uint8_t SpscQueue<T, MAX_SIZE>::put_n(const T *t, uint8_t count) {
+  uint8_t head = _head.load(std::memory_order_relaxed);
+  uint8_t free = MAX_SIZE - (uint8_t)(head - _tail.load(std::memory_order_acquire));
+
+  if (count > free) {
+    _dropped = _dropped + count - free;
+    count = free;
+  }
+  if (count) {
+    copyIn(head, t, count);
+    _head.store(head + count, std::memory_order_release); // Consumer sees the whole burst at once
+  }
+
+  return count;
+}
+
+template <class T, uint8_t MAX_SIZE>
+bool SpscQueue<T, MAX_SIZE>::peek(T &t) {
+  uint8_t tail = _tail.load(std::memory_order_relaxed);
+
+  if (tail == _head.load(std::memory_order_acquire))
+    return false;
+  memcpy(&t, &_items[tail & (MAX_SIZE - 1)], sizeof(T));
+
+  return true;
+}
+
+template <class T, uint8_t MAX_SIZE>
+bool SpscQueue<T, MAX_SIZE>::get(T &t) {
+  uint8_t tail = _tail.load(std::memory_order_relaxed);
+
+  if (tail == _head.load(std::memory_order_acquire))
+    return false;
+  memcpy(&t, &_items[tail & (MAX_SIZE - 1)], sizeof(T));
+  _tail.store(tail + 1, std::memory_order_release); // Slot is free for producer only after copy
+
+  return true;
+}
+
+template <class T, uint8_t MAX_SIZE>
+uint8_t SpscQueue<T, MAX_SIZE>::get_n(T *t, uint8_t count) {
+  uint8_t tail = _tail.load(std::memory_order_relaxed);
+  uint8_t depth = _head.load(std::memory_order_acquire) - tail;
+
+  if (count > depth)
+    count = depth;
+  if (count) {
+    copyOut(tail, t, count);
+    _tail.store(tail + count, std::memory_order_release); // Slots are free for producer only after copy
+  }
+
+  return count;
+}
+
+template <class T, uint8_t MAX_SIZE>
+void SpscQueue<T, MAX_SIZE>::copyIn(uint8_t head, const T *t, uint8_t count) {
+  uint8_t index = head & (MAX_SIZE - 1);
+  uint8_t first = MAX_SIZE - index; // Up to the end of _items
+
+  if (first > count)
+    first = count;
+  memcpy(&_items[index], t, sizeof(T) * first);
+  if (count > first) // Wrapped around
+    memcpy(&_items[0], &t[first], sizeof(T) * (count - first));
+}
+
+template <class T, uint8_t MAX_SIZE>
+void SpscQueue<T, MAX_SIZE>::copyOut(uint8_t tail, T *t, uint8_t count) {
+  uint8_t index = tail & (MAX_SIZE - 1);
+  uint8_t first = MAX_SIZE - index;
+
+  if (first > count)
+    first = count;
+  memcpy(t, &_items[index], sizeof(T) * first);
+  if (count > first)
+    memcpy(&t[first], &_items[0], sizeof(T) * (count - first));
+}
+
 #endif
@@ -0,0 +1,180 @@
+#include <stdarg.h>
+#include <Arduino.h>
+#include <FunctionalInterrupt.h>
+#include <ESP8266WiFi.h>
+
+/***
+ * Numeric conversions
+ ***/
+
+char *ultoa(unsigned long value, char *result, int base) {
+  char *p = result, *q;
+
+  if ((base < 2) || (base > 36)) {
+    *result = '\0';
+    return result;
+  }
+  do {
+    uint8_t digit = value % base;
+
+    *p++ = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    value /= base;
+  } while (value);
+  *p-- = '\0';
+  for (q = result; q < p; ++q, --p) {
+    char c = *q;
+
+    *q = *p;
+    *p = c;
+  }
+
+  return result;
+}
+
+char *ltoa(long value, char *result, int base) {
+  if ((value < 0) && (base == 10)) {
+    *result = '-';
+    ultoa(-(unsigned long)value, &result[1], base);
+    return result;
+  }
+
+  return ultoa((unsigned long)value, result, base);
+}
+
+char *utoa(unsigned int value, char *result, int base) {
+  return ultoa(value, result, base);
+}
+
+char *itoa(int value, char *result, int base) {
+  return ltoa(value, result, base);
+}
+
+/***
+ * String class implementation
+ ***/
+
+String::String(int value, unsigned char base) {
+  char buf[34];
+
+  _str = itoa(value, buf, base);
+}
+
+String::String(unsigned int value, unsigned char base) {
+  char buf[33];
+
+  _str = utoa(value, buf, base);
+}
+
+String::String(long value, unsigned char base) {
+  char buf[66];
+
+  _str = ltoa(value, buf, base);
+}
+
+String::String(unsigned long value, unsigned char base) {
+  char buf[65];
+
+  _str = ultoa(value, buf, base);
+}
+
+/***
+ * Print class implementation
+ ***/
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+
+  while (size--) {
+    n += write(*buffer++);
+  }
+
+  return n;
+}
+
+size_t Print::printf(const char *format, ...) {
+  char buf[256];
+  va_list arg;
+  int len;
+
+  va_start(arg, format);
+  len = vsnprintf(buf, sizeof(buf), format, arg);
+  va_end(arg);
+  if (len < 0)
+    return 0;
+  if (len >= (int)sizeof(buf))
+    len = sizeof(buf) - 1;
+
+  return write((const uint8_t*)buf, len);
+}
+
+size_t Print::printf_P(PGM_P format, ...) {
+  char buf[256];
+  va_list arg;
+  int len;
+
+  va_start(arg, format);
+  len = vsnprintf(buf, sizeof(buf), format, arg);
+  va_end(arg);
+  if (len < 0)
+    return 0;
+  if (len >= (int)sizeof(buf))
+    len = sizeof(buf) - 1;
+
+  return write((const uint8_t*)buf, len);
+}
+
+size_t Print::print(long value, int base) {
+  char buf[66];
+
+  return write(ltoa(value, buf, base));
+}
+
+size_t Print::print(unsigned long value, int base) {
+  char buf[65];
+
+  return write(ultoa(value, buf, base));
+}
+
+size_t Print::print(double value, int digits) {
+  char buf[64];
+
+  snprintf(buf, sizeof(buf), "%.*f", digits, value);
+
+  return write(buf);
+}
+
+/***
+ * IPAddress class implementation
+ ***/
+
+String IPAddress::toString() const {
+  char buf[16];
+
+  sprintf(buf, "%u.%u.%u.%u", _address & 0xFF, (_address >> 8) & 0xFF, (_address >> 16) & 0xFF, _address >> 24);
+
+  return String(buf);
+}
+
+size_t IPAddress::printTo(Print &p) const {
+  return p.print(toString());
+}
+
+/***
+ * GPIO stubs (LEDs and buttons are not simulated)
+ ***/
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t val) {}
+
+int digitalRead(uint8_t pin) {
+  return HIGH;
+}
+
+void analogWrite(uint8_t pin, int val) {}
+
+void attachInterrupt(uint8_t pin, void (*userFunc)(void), int mode) {}
+
+void attachInterrupt(uint8_t pin, std::function<void(void)> intRoutine, int mode) {}
+
+void detachInterrupt(uint8_t pin) {}
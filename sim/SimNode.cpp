@@ -0,0 +1,854 @@
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/socket.h>
+#include <vector>
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <AsyncMqttClient.h>
+#include <espnow.h>
+#include "SimNode.h"
+
+/*
+ * Runtime of one simulated node. Every node is a separate process running the
+ * real setup()/loop(); SDK callbacks are fired from delay()/yield() exactly as
+ * the ESP8266 core does from the system task.
+ */
+
+static const uint8_t ESPNOW_MAX_PEERS = 20; // SDK limit (ESP_NOW_MAX_TOTAL_PEER_NUM)
+static const uint8_t WIFI_CHANNELS = 13;
+static const uint32_t SIM_HEAP_SIZE = 52 * 1024;
+
+struct espnow_peer_t {
+  uint8_t mac[6];
+  uint8_t role;
+  uint8_t channel;
+  bool secure;
+};
+
+static sim_node_t _node;
+static uint64_t _boot;
+static bool _pumping = false;
+static uint32_t _random;
+
+static bool _espnow_init = false;
+static uint8_t _espnow_role = ESP_NOW_ROLE_IDLE;
+static esp_now_recv_cb_t _espnow_recv_cb = NULL;
+static const uint8_t RX_HEADER = 51; // RxControl and action frame header in front of SDK receive callback data
+static esp_now_send_cb_t _espnow_send_cb = NULL;
+static espnow_peer_t _espnow_peers[ESPNOW_MAX_PEERS];
+static uint8_t _espnow_peer_count = 0;
+static uint8_t _espnow_fetch = 0;
+
+static WiFiMode_t _wifi_mode = WIFI_STA;
+static uint8_t _radio_channel = 1;
+static bool _sta_connecting = false;
+static bool _sta_connected = false;
+static uint32_t _sta_connect_at;
+static uint32_t _sta_blocked_until = 0;
+static bool _ap_up = false;
+static bool _scanning = false;
+static std::vector<sim_ap_t> _scan_result;
+static std::vector<std::function<void(const WiFiEventStationModeGotIP&)> > _onGotIP;
+static std::vector<std::function<void(const WiFiEventStationModeDisconnected&)> > _onDisconnected;
+
+static AsyncMqttClient *_mqtt = NULL;
+
+HardwareSerial Serial;
+EspClass ESP;
+ESP8266WiFiClass WiFi;
+
+static uint64_t monotonic() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool simNodeSend(const sim_msg_hdr_t *hdr, const void *data) {
+  sim_msg_t msg;
+
+  msg.hdr = *hdr;
+  if (msg.hdr.len > SIM_MAX_DATA)
+    return false;
+  if (msg.hdr.len)
+    memcpy(msg.data, data, msg.hdr.len);
+
+  return (send(_node.fd, &msg, sizeof(msg.hdr) + msg.hdr.len, MSG_NOSIGNAL) > 0);
+}
+
+static void sendShort(sim_msg_type_t type, const uint8_t *mac, uint8_t channel, const void *data = NULL, uint16_t len = 0) {
+  sim_msg_hdr_t hdr;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.type = type;
+  if (mac)
+    memcpy(hdr.mac, mac, sizeof(hdr.mac));
+  hdr.channel = channel;
+  hdr.len = len;
+  simNodeSend(&hdr, data);
+}
+
+static void tuneRadio(uint8_t channel) {
+  if (channel && (channel != _radio_channel)) {
+    _radio_channel = channel;
+    sendShort(SIM_CHANNEL, NULL, channel);
+  }
+}
+
+static void staConnected() {
+  WiFiEventStationModeGotIP event;
+
+  _sta_connecting = false;
+  _sta_connected = true;
+  tuneRadio(_node.sta_channel);
+  event.ip = IPAddress(192, 168, 1, 100 + _node.index % 150);
+  event.mask = IPAddress(255, 255, 255, 0);
+  event.gw = IPAddress(192, 168, 1, 1);
+  for (size_t i = 0; i < _onGotIP.size(); ++i) {
+    _onGotIP[i](event);
+  }
+}
+
+static void staDisconnected(WiFiDisconnectReason reason) {
+  WiFiEventStationModeDisconnected event;
+
+  _sta_connected = false;
+  if (_mqtt)
+    _mqtt->_drop();
+  memset(event.bssid, 0, sizeof(event.bssid));
+  event.reason = reason;
+  for (size_t i = 0; i < _onDisconnected.size(); ++i) {
+    _onDisconnected[i](event);
+  }
+}
+
+static void dispatch(const sim_msg_t *msg) {
+  switch (msg->hdr.type) {
+    case SIM_FRAME:
+      if ((! _scanning) && _espnow_init && _espnow_recv_cb) {
+        uint8_t frame[RX_HEADER + SIM_MAX_DATA];
+
+        memset(frame, 0, RX_HEADER);
+        frame[0] = msg->hdr.rssi; // RxControl.rssi
+        memcpy(&frame[RX_HEADER], msg->data, msg->hdr.len);
+        _espnow_recv_cb((uint8_t*)msg->hdr.mac, &frame[RX_HEADER], msg->hdr.len);
+      }
+      break;
+    case SIM_TX_STATUS:
+      if (_espnow_init && _espnow_send_cb)
+        _espnow_send_cb((uint8_t*)msg->hdr.mac, msg->hdr.status);
+      break;
+    case SIM_SCAN_RESULT:
+      _scan_result.assign((const sim_ap_t*)msg->data, (const sim_ap_t*)&msg->data[msg->hdr.len / sizeof(sim_ap_t) * sizeof(sim_ap_t)]);
+      break;
+    case SIM_WIFI_DROP:
+      if (_sta_connected || _sta_connecting) {
+        uint32_t outage;
+
+        memcpy(&outage, msg->data, sizeof(outage));
+        _sta_blocked_until = millis() + outage;
+        _sta_connecting = true; // Auto reconnect
+        _sta_connect_at = _sta_blocked_until + _node.wifi_connect_time;
+        if (_sta_connected)
+          staDisconnected(WIFI_DISCONNECT_REASON_BEACON_TIMEOUT);
+      }
+      break;
+    case SIM_MQTT_MESSAGE:
+      if (_mqtt) {
+        char data[SIM_MAX_DATA + 1];
+        size_t topic_len;
+
+        memcpy(data, msg->data, msg->hdr.len);
+        data[msg->hdr.len] = '\0';
+        topic_len = strlen(data);
+        if (topic_len < msg->hdr.len)
+          _mqtt->_message(data, &data[topic_len + 1], msg->hdr.len - topic_len - 1);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static void timers() {
+  if (_sta_connecting && ((int32_t)(millis() - _sta_connect_at) >= 0))
+    staConnected();
+  if (_mqtt)
+    _mqtt->_poll();
+}
+
+/*
+ * Wait up to timeout ms. for hub messages and dispatch them. Nested calls
+ * (delay() inside a callback) only sleep, like the SDK never reenters itself.
+ */
+static void pump(uint32_t timeout) {
+  struct pollfd pfd;
+  sim_msg_t msg;
+  int r;
+
+  if (_pumping) {
+    if (timeout)
+      usleep(timeout * 1000);
+    return;
+  }
+  _pumping = true;
+  timers();
+  pfd.fd = _node.fd;
+  pfd.events = POLLIN;
+  if (_sta_connecting && (timeout > 1))
+    timeout = 1;
+  r = poll(&pfd, 1, timeout);
+  while (r > 0) {
+    if (pfd.revents & (POLLHUP | POLLERR))
+      _exit(0); // Hub is gone
+    ssize_t len = recv(_node.fd, &msg, sizeof(msg), MSG_DONTWAIT);
+    if (len < (ssize_t)sizeof(msg.hdr)) {
+      if ((len == 0) || ((len < 0) && (errno != EAGAIN) && (errno != EINTR)))
+        _exit(0);
+      break;
+    }
+    dispatch(&msg);
+    r = poll(&pfd, 1, 0);
+  }
+  timers();
+  _pumping = false;
+}
+
+void simNodeRun(const sim_node_t *node, sim_entry_t setup, sim_entry_t loop) {
+  _node = *node;
+  _boot = monotonic();
+  _random = 0x9E3779B9 ^ (_node.index * 2654435761U) ^ (uint32_t)_boot;
+  if (! _random)
+    _random = 1;
+  sendShort(SIM_CHANNEL, NULL, _radio_channel);
+  setup();
+  for (;;) {
+    loop();
+    yield();
+  }
+}
+
+/***
+ * Arduino core
+ ***/
+
+uint32_t millis() {
+  return (monotonic() - _boot) / 1000;
+}
+
+uint32_t micros() {
+  return monotonic() - _boot;
+}
+
+void delay(uint32_t ms) {
+  uint64_t deadline = monotonic() + (uint64_t)ms * 1000;
+  uint64_t now;
+
+  pump(0);
+  while ((now = monotonic()) < deadline) {
+    pump((deadline - now + 999) / 1000);
+  }
+}
+
+void delayMicroseconds(uint32_t us) {
+  uint64_t deadline = monotonic() + us;
+
+  while (monotonic() < deadline);
+}
+
+void yield() {
+  pump(0);
+}
+
+long random(long howbig) {
+  if (howbig <= 0)
+    return 0;
+  _random ^= _random << 13;
+  _random ^= _random >> 17;
+  _random ^= _random << 5;
+
+  return _random % howbig;
+}
+
+long random(long howsmall, long howbig) {
+  if (howsmall >= howbig)
+    return howsmall;
+
+  return random(howbig - howsmall) + howsmall;
+}
+
+/***
+ * HardwareSerial class implementation
+ ***/
+
+static char _line[256];
+static size_t _line_len = 0;
+
+static void flushLine() {
+  static const char COMMAND[] = "Command received: \"";
+
+  if ((! _node.gateway) && (_line_len > sizeof(COMMAND)) && (! memcmp(_line, COMMAND, sizeof(COMMAND) - 1)))
+    sendShort(SIM_COMMAND_RUN, NULL, 0, &_line[sizeof(COMMAND) - 1], _line_len - sizeof(COMMAND)); // Without quotes
+  if (_line_len && _node.log) {
+    char prefix[32];
+    int len;
+    uint32_t ms = millis();
+
+    if (! _node.gateway)
+      len = snprintf(prefix, sizeof(prefix), "%6u.%03u n%03u| ", ms / 1000, ms % 1000, _node.index);
+    else if (_node.index)
+      len = snprintf(prefix, sizeof(prefix), "%6u.%03u gw%-2u| ", ms / 1000, ms % 1000, _node.index);
+    else
+      len = snprintf(prefix, sizeof(prefix), "%6u.%03u gw  | ", ms / 1000, ms % 1000);
+    {
+      char out[sizeof(prefix) + sizeof(_line) + 1];
+
+      memcpy(out, prefix, len);
+      memcpy(&out[len], _line, _line_len);
+      out[len + _line_len] = '\n';
+      if (write(STDOUT_FILENO, out, len + _line_len + 1) < 0) {
+        // Nothing to do
+      }
+    }
+  }
+  _line_len = 0;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (c == '\n') {
+    flushLine();
+  } else if (c != '\r') {
+    if (_line_len >= sizeof(_line))
+      flushLine();
+    _line[_line_len++] = c;
+  }
+
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    write(buffer[i]);
+  }
+
+  return size;
+}
+
+void HardwareSerial::flush() {
+  flushLine();
+}
+
+/***
+ * EspClass implementation
+ ***/
+
+uint32_t EspClass::getChipId() {
+  return (_node.mac[3] << 16) | (_node.mac[4] << 8) | _node.mac[5];
+}
+
+uint32_t EspClass::getFreeHeap() {
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+  size_t used = mallinfo2().uordblks;
+#else
+  size_t used = mallinfo().uordblks;
+#endif
+
+  return used < SIM_HEAP_SIZE ? SIM_HEAP_SIZE - used : 0;
+}
+
+void EspClass::restart() {
+  Serial.flush();
+  _exit(SIM_EXIT_RESTART);
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
+  if ((offset * 4 + size > sizeof(_node.rtc)) || (size % 4))
+    return false;
+  memcpy(data, &_node.rtc[offset * 4], size);
+
+  return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size) {
+  if ((offset * 4 + size > sizeof(_node.rtc)) || (size % 4))
+    return false;
+  memcpy(&_node.rtc[offset * 4], data, size);
+  sendShort(SIM_RTC, NULL, 0, _node.rtc, sizeof(_node.rtc));
+
+  return true;
+}
+
+void EspClass::deepSleep(uint64_t time_us, RFMode mode) {
+  Serial.flush();
+  if (time_us) {
+    sendShort(SIM_SLEEP, NULL, 0, &time_us, sizeof(time_us));
+    _exit(SIM_EXIT_SLEEP);
+  }
+  _exit(SIM_EXIT_HALT);
+}
+
+/***
+ * ESP8266WiFiClass implementation
+ ***/
+
+bool ESP8266WiFiClass::mode(WiFiMode_t mode) {
+  if ((_wifi_mode & WIFI_AP) && (! (mode & WIFI_AP)))
+    softAPdisconnect();
+  if ((_wifi_mode & WIFI_STA) && (! (mode & WIFI_STA)))
+    disconnect();
+  _wifi_mode = mode;
+
+  return true;
+}
+
+WiFiMode_t ESP8266WiFiClass::getMode() {
+  return _wifi_mode;
+}
+
+int ESP8266WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid, bool connect) {
+  if (! (_wifi_mode & WIFI_STA))
+    _wifi_mode = (WiFiMode_t)(_wifi_mode | WIFI_STA);
+  if (_sta_connected)
+    staDisconnected(WIFI_DISCONNECT_REASON_UNSPECIFIED);
+  if (connect) {
+    _sta_connecting = true;
+    _sta_connect_at = millis() + _node.wifi_connect_time;
+    if ((int32_t)(_sta_blocked_until - _sta_connect_at) > 0)
+      _sta_connect_at = _sta_blocked_until + _node.wifi_connect_time;
+  }
+
+  return 0;
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifioff) {
+  _sta_connecting = false;
+  if (_sta_connected)
+    staDisconnected(WIFI_DISCONNECT_REASON_UNSPECIFIED);
+
+  return true;
+}
+
+bool ESP8266WiFiClass::isConnected() {
+  return _sta_connected;
+}
+
+IPAddress ESP8266WiFiClass::localIP() {
+  return _sta_connected ? IPAddress(192, 168, 1, 100 + _node.index % 150) : IPAddress();
+}
+
+uint8_t *ESP8266WiFiClass::macAddress(uint8_t *mac) {
+  memcpy(mac, _node.mac, sizeof(_node.mac));
+
+  return mac;
+}
+
+String ESP8266WiFiClass::macAddress() {
+  char str[18];
+
+  sprintf(str, "%02X:%02X:%02X:%02X:%02X:%02X", _node.mac[0], _node.mac[1], _node.mac[2], _node.mac[3], _node.mac[4], _node.mac[5]);
+
+  return String(str);
+}
+
+int32_t ESP8266WiFiClass::channel() {
+  return _radio_channel;
+}
+
+int32_t ESP8266WiFiClass::RSSI() {
+  return _sta_connected ? -50 : 31;
+}
+
+bool ESP8266WiFiClass::softAP(const char *ssid, const char *passphrase, int channel, int ssid_hidden, int max_connection) {
+  _wifi_mode = (WiFiMode_t)(_wifi_mode | WIFI_AP);
+  if (_sta_connected) // Soft AP always follows the station channel
+    channel = _radio_channel;
+  if ((channel < 1) || (channel > WIFI_CHANNELS))
+    return false;
+  tuneRadio(channel);
+  _ap_up = true;
+  sendShort(SIM_AP, NULL, channel, ssid, strlen(ssid));
+
+  return true;
+}
+
+bool ESP8266WiFiClass::softAPdisconnect(bool wifioff) {
+  if (_ap_up) {
+    _ap_up = false;
+    sendShort(SIM_AP, NULL, 0);
+  }
+
+  return true;
+}
+
+uint8_t *ESP8266WiFiClass::softAPmacAddress(uint8_t *mac) {
+  return macAddress(mac);
+}
+
+int8_t ESP8266WiFiClass::scanNetworks(bool async, bool show_hidden, uint8_t channel, uint8_t *ssid) {
+  uint32_t start = millis();
+  uint32_t duration = _node.scan_time * (channel ? 1 : WIFI_CHANNELS);
+
+  _scan_result.clear();
+  sendShort(SIM_SCAN, NULL, channel, ssid, ssid ? strlen((const char*)ssid) : 0);
+  _scanning = true; // Radio is off the working channel, incoming frames are lost
+  while (millis() - start < duration) {
+    delay(1);
+  }
+  _scanning = false;
+  if (! show_hidden) // Simulated gateways only advertise hidden SSID
+    _scan_result.clear();
+
+  return _scan_result.size();
+}
+
+void ESP8266WiFiClass::scanDelete() {
+  _scan_result.clear();
+}
+
+int32_t ESP8266WiFiClass::channel(uint8_t networkItem) {
+  return networkItem < _scan_result.size() ? _scan_result[networkItem].channel : 0;
+}
+
+uint8_t *ESP8266WiFiClass::BSSID(uint8_t networkItem) {
+  return networkItem < _scan_result.size() ? _scan_result[networkItem].bssid : NULL;
+}
+
+int32_t ESP8266WiFiClass::RSSI(uint8_t networkItem) {
+  return networkItem < _scan_result.size() ? _scan_result[networkItem].rssi : 0;
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP&)> f) {
+  _onGotIP.push_back(f);
+
+  return WiFiEventHandler();
+}
+
+WiFiEventHandler ESP8266WiFiClass::onStationModeDisconnected(std::function<void(const WiFiEventStationModeDisconnected&)> f) {
+  _onDisconnected.push_back(f);
+
+  return WiFiEventHandler();
+}
+
+bool wifi_set_channel(uint8_t channel) {
+  if ((channel < 1) || (channel > WIFI_CHANNELS))
+    return false;
+  tuneRadio(channel);
+
+  return true;
+}
+
+uint8_t wifi_get_channel(void) {
+  return _radio_channel;
+}
+
+/***
+ * ESP-NOW API
+ ***/
+
+static const int ESPNOW_OK = 0;
+static const int ESPNOW_FAIL = -1;
+
+static espnow_peer_t *espnowPeer(const uint8_t *mac) {
+  for (uint8_t i = 0; i < _espnow_peer_count; ++i) {
+    if (! memcmp(_espnow_peers[i].mac, mac, 6))
+      return &_espnow_peers[i];
+  }
+
+  return NULL;
+}
+
+static bool isBroadcast(const uint8_t *mac) {
+  for (uint8_t i = 0; i < 6; ++i) {
+    if (mac[i] != 0xFF)
+      return false;
+  }
+
+  return true;
+}
+
+int esp_now_init(void) {
+  _espnow_init = true;
+
+  return ESPNOW_OK;
+}
+
+int esp_now_deinit(void) {
+  _espnow_init = false;
+  _espnow_recv_cb = NULL;
+  _espnow_send_cb = NULL;
+  _espnow_peer_count = 0;
+
+  return ESPNOW_OK;
+}
+
+int esp_now_register_send_cb(esp_now_send_cb_t cb) {
+  _espnow_send_cb = cb;
+
+  return ESPNOW_OK;
+}
+
+int esp_now_unregister_send_cb(void) {
+  _espnow_send_cb = NULL;
+
+  return ESPNOW_OK;
+}
+
+int esp_now_register_recv_cb(esp_now_recv_cb_t cb) {
+  _espnow_recv_cb = cb;
+
+  return ESPNOW_OK;
+}
+
+int esp_now_unregister_recv_cb(void) {
+  _espnow_recv_cb = NULL;
+
+  return ESPNOW_OK;
+}
+
+static int espnowSend(const uint8_t *da, const uint8_t *data, int len) {
+  sim_msg_hdr_t hdr;
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.type = SIM_FRAME;
+  memcpy(hdr.mac, da, sizeof(hdr.mac));
+  hdr.channel = _radio_channel;
+  hdr.len = len;
+
+  return simNodeSend(&hdr, data) ? ESPNOW_OK : ESPNOW_FAIL;
+}
+
+int esp_now_send(uint8_t *da, uint8_t *data, int len) {
+  if ((! _espnow_init) || (len <= 0) || (len > SIM_MAX_FRAME))
+    return ESPNOW_FAIL;
+  if (! da) {
+    if (! _espnow_peer_count)
+      return ESPNOW_FAIL;
+    for (uint8_t i = 0; i < _espnow_peer_count; ++i) {
+      if (espnowSend(_espnow_peers[i].mac, data, len) != ESPNOW_OK)
+        return ESPNOW_FAIL;
+    }
+    return ESPNOW_OK;
+  }
+  if ((! isBroadcast(da)) && (! espnowPeer(da)))
+    return ESPNOW_FAIL;
+
+  return espnowSend(da, data, len);
+}
+
+int esp_now_add_peer(uint8_t *mac, uint8_t role, uint8_t channel, uint8_t *key, uint8_t key_len) {
+  espnow_peer_t *peer;
+
+  if (! _espnow_init)
+    return ESPNOW_FAIL;
+  peer = espnowPeer(mac);
+  if (! peer) {
+    if (_espnow_peer_count >= ESPNOW_MAX_PEERS)
+      return ESPNOW_FAIL;
+    peer = &_espnow_peers[_espnow_peer_count++];
+    memcpy(peer->mac, mac, sizeof(peer->mac));
+  }
+  peer->role = role;
+  peer->channel = channel;
+  peer->secure = key && key_len;
+
+  return ESPNOW_OK;
+}
+
+int esp_now_del_peer(uint8_t *mac) {
+  espnow_peer_t *peer = espnowPeer(mac);
+
+  if (! peer)
+    return ESPNOW_FAIL;
+  *peer = _espnow_peers[--_espnow_peer_count];
+
+  return ESPNOW_OK;
+}
+
+int esp_now_set_self_role(uint8_t role) {
+  if (role >= ESP_NOW_ROLE_MAX)
+    return ESPNOW_FAIL;
+  _espnow_role = role;
+
+  return ESPNOW_OK;
+}
+
+int esp_now_get_self_role(void) {
+  return _espnow_role;
+}
+
+int esp_now_set_peer_role(uint8_t *mac, uint8_t role) {
+  espnow_peer_t *peer = espnowPeer(mac);
+
+  if (! peer)
+    return ESPNOW_FAIL;
+  peer->role = role;
+
+  return ESPNOW_OK;
+}
+
+int esp_now_get_peer_role(uint8_t *mac) {
+  espnow_peer_t *peer = espnowPeer(mac);
+
+  return peer ? peer->role : ESPNOW_FAIL;
+}
+
+int esp_now_set_peer_channel(uint8_t *mac, uint8_t channel) {
+  espnow_peer_t *peer = espnowPeer(mac);
+
+  if (! peer)
+    return ESPNOW_FAIL;
+  peer->channel = channel;
+
+  return ESPNOW_OK;
+}
+
+int esp_now_get_peer_channel(uint8_t *mac) {
+  espnow_peer_t *peer = espnowPeer(mac);
+
+  return peer ? peer->channel : ESPNOW_FAIL;
+}
+
+int esp_now_set_peer_key(uint8_t *mac, uint8_t *key, uint8_t key_len) {
+  espnow_peer_t *peer = espnowPeer(mac);
+
+  if (! peer)
+    return ESPNOW_FAIL;
+  peer->secure = key && key_len;
+
+  return ESPNOW_OK;
+}
+
+int esp_now_get_peer_key(uint8_t *mac, uint8_t *key, uint8_t *key_len) {
+  return ESPNOW_FAIL;
+}
+
+uint8_t *esp_now_fetch_peer(bool restart) {
+  if (restart)
+    _espnow_fetch = 0;
+  if (_espnow_fetch < _espnow_peer_count)
+    return _espnow_peers[_espnow_fetch++].mac;
+
+  return NULL;
+}
+
+int esp_now_is_peer_exist(uint8_t *mac) {
+  return espnowPeer(mac) ? 1 : 0;
+}
+
+int esp_now_get_cnt_info(uint8_t *all_cnt, uint8_t *encrypt_cnt) {
+  uint8_t secure = 0;
+
+  for (uint8_t i = 0; i < _espnow_peer_count; ++i) {
+    if (_espnow_peers[i].secure)
+      ++secure;
+  }
+  *all_cnt = _espnow_peer_count;
+  *encrypt_cnt = secure;
+
+  return ESPNOW_OK;
+}
+
+int esp_now_set_kok(uint8_t *key, uint8_t len) {
+  return ESPNOW_OK;
+}
+
+/***
+ * AsyncMqttClient class implementation
+ ***/
+
+AsyncMqttClient::AsyncMqttClient() : _connected(false), _connecting(false), _connectAt(0), _nextPacketId(1) {
+  _mqtt = this;
+}
+
+AsyncMqttClient::~AsyncMqttClient() {
+  if (_mqtt == this)
+    _mqtt = NULL;
+}
+
+void AsyncMqttClient::connect() {
+  if (_connected || _connecting)
+    return;
+  _connecting = true;
+  _connectAt = millis() + _node.mqtt_connect_time;
+}
+
+void AsyncMqttClient::disconnect(bool force) {
+  _connecting = false;
+  if (_connected) {
+    _connected = false;
+    if (_onDisconnect)
+      _onDisconnect(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+  }
+}
+
+uint16_t AsyncMqttClient::subscribe(const char *topic, uint8_t qos) {
+  if (! _connected)
+    return 0;
+  if (! _nextPacketId)
+    ++_nextPacketId;
+
+  return _nextPacketId++;
+}
+
+uint16_t AsyncMqttClient::unsubscribe(const char *topic) {
+  return subscribe(topic, 0);
+}
+
+uint16_t AsyncMqttClient::publish(const char *topic, uint8_t qos, bool retain, const char *payload, size_t length, bool dup, uint16_t message_id) {
+  uint8_t data[SIM_MAX_DATA];
+  size_t topic_len, payload_len;
+
+  if (! _connected)
+    return 0;
+  topic_len = strlen(topic) + 1;
+  payload_len = payload ? (length ? length : strlen(payload)) : 0;
+  if (topic_len + payload_len > sizeof(data))
+    return 0;
+  memcpy(data, topic, topic_len);
+  if (payload_len)
+    memcpy(&data[topic_len], payload, payload_len);
+  sendShort(SIM_PUBLISH, NULL, qos, data, topic_len + payload_len);
+  if (! qos)
+    return 1;
+  if (! _nextPacketId)
+    ++_nextPacketId;
+
+  return _nextPacketId++;
+}
+
+void AsyncMqttClient::_poll() {
+  if (_connecting && ((int32_t)(millis() - _connectAt) >= 0)) {
+    _connecting = false;
+    if (_sta_connected) {
+      _connected = true;
+      if (_onConnect)
+        _onConnect(false);
+    } else if (_onDisconnect) {
+      _onDisconnect(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+    }
+  }
+}
+
+void AsyncMqttClient::_message(char *topic, char *payload, size_t len) {
+  AsyncMqttClientMessageProperties properties;
+
+  if ((! _connected) || (! _onMessage))
+    return;
+  properties.qos = 0;
+  properties.dup = false;
+  properties.retain = false;
+  _onMessage(topic, payload, properties, len, 0, len);
+}
+
+void AsyncMqttClient::_drop() {
+  _connecting = false;
+  if (_connected) {
+    _connected = false;
+    if (_onDisconnect)
+      _onDisconnect(AsyncMqttClientDisconnectReason::TCP_DISCONNECTED);
+  }
+}
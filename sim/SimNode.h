@@ -0,0 +1,25 @@
+#ifndef __SIMNODE_H
+#define __SIMNODE_H
+
+#include <inttypes.h>
+#include "SimProtocol.h"
+
+struct sim_node_t {
+  int fd; // Socket to the radio hub
+  uint16_t index;
+  uint8_t mac[6];
+  uint8_t sta_channel; // Channel of the simulated WiFi router
+  uint32_t wifi_connect_time; // ms.
+  uint32_t mqtt_connect_time; // ms.
+  uint32_t scan_time; // ms. per channel
+  uint8_t rtc[SIM_RTC_SIZE]; // RTC user memory kept by hub over restarts and deep sleep
+  bool gateway;
+  bool log;
+};
+
+typedef void (*sim_entry_t)();
+
+void simNodeRun(const sim_node_t *node, sim_entry_t setup, sim_entry_t loop) __attribute__((noreturn));
+bool simNodeSend(const sim_msg_hdr_t *hdr, const void *data);
+
+#endif
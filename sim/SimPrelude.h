@@ -0,0 +1,24 @@
+#ifndef __SIMPRELUDE_H
+#define __SIMPRELUDE_H
+
+/*
+ * Everything src/main.cpp includes must be pulled in here, outside of the
+ * namespace main.cpp is wrapped into, so that the include guards turn the
+ * includes inside main.cpp into no-ops.
+ */
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <AsyncMqttClient.h>
+#include "EspNowHelper.h"
+#include "SpscRing.h"
+#include "PeerTable.h"
+#include "PublishQueue.h"
+#include "FlashLog.h"
+#include "Tlv.h"
+#include "Trace.h"
+#include "Histogram.h"
+#include "Leds.h"
+#include "SimTargets.h"
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef __SIMPROTOCOL_H
+#define __SIMPROTOCOL_H
+
+#include <inttypes.h>
+
+#ifndef __packed
+#define __packed __attribute__((packed))
+#endif
+
+/*
+ * Messages exchanged between a simulated node process and the radio hub over
+ * a SOCK_SEQPACKET socket pair (one message per packet).
+ */
+
+static const uint16_t SIM_MAX_DATA = 512;
+static const uint8_t SIM_MAX_FRAME = 250; // ESP-NOW payload limit
+static const uint16_t SIM_RTC_SIZE = 512; // RTC user memory
+
+enum sim_msg_type_t : uint8_t {
+  SIM_FRAME, // node -> hub: transmit (mac = destination), hub -> node: receive (mac = source)
+  SIM_TX_STATUS, // hub -> node: send callback (mac = destination, status = 0 on success)
+  SIM_CHANNEL, // node -> hub: radio tuned to channel
+  SIM_AP, // node -> hub: soft AP started on channel (0 = stopped), data = SSID
+  SIM_SCAN, // node -> hub: scan request (channel = 0 for all), data = SSID filter
+  SIM_SCAN_RESULT, // hub -> node: data = array of sim_ap_t
+  SIM_PUBLISH, // node -> hub: MQTT publish, data = topic '\0' value
+  SIM_SLEEP, // node -> hub: going to deep sleep, data = uint64_t sleep time (us.)
+  SIM_WIFI_DROP, // hub -> node: station link lost, data = uint32_t outage time (ms.)
+  SIM_MQTT_MESSAGE, // hub -> node: message from MQTT broker, data = topic '\0' payload
+  SIM_RTC, // node -> hub: RTC user memory changed, data = all of it
+  SIM_COMMAND_RUN // node -> hub: client executed a command, data = its payload
+};
+
+struct __packed sim_msg_hdr_t {
+  sim_msg_type_t type;
+  uint8_t mac[6];
+  uint8_t channel;
+  uint8_t status;
+  int8_t rssi;
+  uint16_t len;
+};
+
+struct __packed sim_msg_t {
+  sim_msg_hdr_t hdr;
+  uint8_t data[SIM_MAX_DATA];
+};
+
+struct __packed sim_ap_t {
+  uint8_t bssid[6];
+  uint8_t channel;
+  int8_t rssi;
+};
+
+enum sim_exit_t { SIM_EXIT_RESTART = 3, SIM_EXIT_HALT, SIM_EXIT_SLEEP };
+
+#endif
@@ -0,0 +1,704 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <algorithm>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "SimRadio.h"
+#include "SimNode.h"
+#include "SimTargets.h"
+
+// 802.11b DSSS timing of an ESP-NOW vendor specific action frame
+static const uint32_t PHY_PREAMBLE = 192; // us. long preamble + PLCP header
+static const uint32_t MAC_OVERHEAD = 43; // bytes: MAC header, action frame header, vendor IE, FCS
+static const uint32_t MAC_ACK = 14; // bytes
+static const uint32_t DIFS = 50; // us.
+static const uint32_t SIFS = 10; // us.
+static const uint32_t BACKOFF = 310; // us. mean of CWmin (31 slots of 20 us.) / 2
+
+static const uint32_t WIFI_CONNECT_TIME = 500; // ms.
+static const uint32_t MQTT_CONNECT_TIME = 50; // ms.
+static const uint32_t SCAN_TIME = 120; // ms. per channel
+
+static const uint8_t BROADCAST[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+SimRadio::SimRadio(const sim_config_t &config) : _config(config), _seq(0), _elapsed(0) {
+  _nodes.resize(_config.gateways + _config.clients);
+  for (uint16_t i = 0; i < _nodes.size(); ++i) {
+    node_t &node = _nodes[i];
+
+    node.pid = -1;
+    node.fd = -1;
+    node.mac[0] = 0x5E; // Locally administered
+    node.mac[1] = 0xCF;
+    node.mac[2] = 0x7F;
+    node.mac[3] = 0x00;
+    node.mac[4] = i >> 8;
+    node.mac[5] = i;
+    node.channel = 0;
+    node.ap_channel = 0;
+    node.alive = false;
+    node.halted = false;
+    node.restarts = 0;
+    node.sleeps = 0;
+    node.wake_at = 0;
+    node.spawned_at = 0;
+    node.joined = false;
+    node.gw_data = 0;
+    node.rtc.assign(SIM_RTC_SIZE, 0);
+  }
+  _random = _config.seed ? _config.seed : 0x2545F4914F6CDD1DULL;
+  memset(_busy, 0, sizeof(_busy));
+  memset(&_stats, 0, sizeof(_stats));
+  signal(SIGPIPE, SIG_IGN);
+  {
+    char dir[] = "/tmp/mqtt-now-sim.XXXXXX";
+
+    if (mkdtemp(dir))
+      _flash = dir;
+    else
+      perror("mkdtemp");
+  }
+}
+
+static int removeEntry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+  return remove(path);
+}
+
+SimRadio::~SimRadio() {
+  for (uint16_t i = 0; i < _nodes.size(); ++i) {
+    if (_nodes[i].alive) {
+      kill(_nodes[i].pid, SIGKILL);
+      waitpid(_nodes[i].pid, NULL, 0);
+    }
+    if (_nodes[i].fd >= 0)
+      close(_nodes[i].fd);
+  }
+  if (! _flash.empty())
+    nftw(_flash.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+uint64_t SimRadio::now() const {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t SimRadio::random() {
+  _random ^= _random >> 12;
+  _random ^= _random << 25;
+  _random ^= _random >> 27;
+
+  return _random * 0x2545F4914F6CDD1DULL;
+}
+
+bool SimRadio::lost() {
+  if (_config.loss <= 0)
+    return false;
+
+  return (random() >> 11) * (1.0 / 9007199254740992.0) < _config.loss;
+}
+
+uint32_t SimRadio::airtime(uint8_t len, bool unicast) const {
+  uint32_t result = DIFS + BACKOFF + PHY_PREAMBLE + (uint32_t)((MAC_OVERHEAD + len) * 8 / _config.rate);
+
+  if (unicast)
+    result += SIFS + PHY_PREAMBLE + MAC_ACK * 8; // ACK at 1 Mbps basic rate
+
+  return result;
+}
+
+int8_t SimRadio::rssi(uint16_t a, uint16_t b) const {
+  return -35 - (int8_t)(((uint32_t)a * 37 + (uint32_t)b * 17) % 50);
+}
+
+int16_t SimRadio::nodeByMac(const uint8_t *mac) const {
+  if ((mac[0] != 0x5E) || (mac[1] != 0xCF) || (mac[2] != 0x7F) || mac[3])
+    return -1;
+
+  uint16_t index = (mac[4] << 8) | mac[5];
+
+  return index < _nodes.size() ? index : -1;
+}
+
+void SimRadio::schedule(uint64_t time, event_kind_t kind, uint16_t node, const sim_msg_t *msg) {
+  event_t e;
+
+  e.time = time;
+  e.seq = _seq++;
+  e.kind = kind;
+  e.node = node;
+  if (msg)
+    memcpy(&e.msg, msg, sizeof(msg->hdr) + msg->hdr.len);
+  else
+    memset(&e.msg.hdr, 0, sizeof(e.msg.hdr));
+  _events.push(e);
+}
+
+bool SimRadio::spawn(uint16_t index) {
+  node_t &node = _nodes[index];
+  int sv[2];
+  pid_t pid;
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+    perror("socketpair");
+    return false;
+  }
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    close(sv[0]);
+    close(sv[1]);
+    return false;
+  }
+  if (! pid) {
+    sim_node_t config;
+
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    close(sv[0]);
+    for (uint16_t i = 0; i < _nodes.size(); ++i) {
+      if (_nodes[i].fd >= 0)
+        close(_nodes[i].fd);
+    }
+    if (! _flash.empty()) {
+      std::string dir = _flash + '/' + std::to_string(index);
+
+      mkdir(dir.c_str(), 0700);
+      if (chdir(dir.c_str()))
+        perror("chdir");
+    }
+    config.fd = sv[1];
+    config.index = index;
+    memcpy(config.mac, node.mac, sizeof(config.mac));
+    config.sta_channel = _config.channel;
+    config.wifi_connect_time = WIFI_CONNECT_TIME;
+    config.mqtt_connect_time = MQTT_CONNECT_TIME;
+    config.scan_time = SCAN_TIME;
+    memcpy(config.rtc, node.rtc.data(), sizeof(config.rtc));
+    config.gateway = isGateway(index);
+    config.log = (_config.verbose > 1) || ((_config.verbose == 1) && config.gateway);
+    if (config.gateway)
+      simNodeRun(&config, simGatewaySetup, simGatewayLoop);
+    else if (index - _config.gateways < _config.sleepers)
+      simNodeRun(&config, simSleeperSetup, simSleeperLoop);
+    else
+      simNodeRun(&config, simClientSetup, simClientLoop);
+  }
+  close(sv[1]);
+  fcntl(sv[0], F_SETFL, O_NONBLOCK);
+  node.pid = pid;
+  node.fd = sv[0];
+  node.channel = 0;
+  node.ap_channel = 0;
+  node.alive = true;
+  node.spawned_at = now();
+  node.joined = false;
+  // A fresh boot restarts sequence numbering
+  _readings.erase(_readings.lower_bound((uint32_t)index << 16), _readings.lower_bound((uint32_t)(index + 1) << 16));
+
+  return true;
+}
+
+void SimRadio::reap(uint16_t index) {
+  node_t &node = _nodes[index];
+  int status;
+
+  close(node.fd);
+  node.fd = -1;
+  node.alive = false;
+  node.ap_channel = 0;
+  if (waitpid(node.pid, &status, 0) < 0)
+    status = 0;
+  if (WIFEXITED(status) && (WEXITSTATUS(status) == SIM_EXIT_RESTART)) {
+    ++node.restarts;
+    schedule(now() + BOOT_TIME * 1000, EVT_SPAWN, index);
+  } else if (WIFEXITED(status) && (WEXITSTATUS(status) == SIM_EXIT_SLEEP)) {
+    ++node.sleeps;
+    schedule(std::max(node.wake_at, now() + BOOT_TIME * 1000), EVT_SPAWN, index);
+  } else if (WIFEXITED(status) && (WEXITSTATUS(status) == SIM_EXIT_HALT)) {
+    node.halted = true;
+  } else {
+    fprintf(stderr, "Node %u died unexpectedly (status 0x%X)\n", index, status);
+    ++_stats.crashes;
+  }
+}
+
+void SimRadio::deliver(uint16_t index, const sim_msg_t *msg) {
+  node_t &node = _nodes[index];
+
+  if (node.alive) {
+    if (send(node.fd, msg, sizeof(msg->hdr) + msg->hdr.len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+      ++_stats.rx_overflows;
+  }
+}
+
+void SimRadio::transmit(uint16_t index, const sim_msg_t *msg) {
+  node_t &node = _nodes[index];
+  uint8_t ch = node.channel;
+  bool unicast = memcmp(msg->hdr.mac, BROADCAST, sizeof(BROADCAST)) != 0;
+  uint64_t t;
+  sim_msg_t frame;
+  sim_frame_kind_t kind;
+  uint16_t num;
+
+  if ((! ch) || (ch >= CHANNELS) || (msg->hdr.len > SIM_MAX_FRAME))
+    return;
+  t = std::max(now(), _busy[ch]);
+  ++_stats.tx_frames;
+  _stats.tx_bytes += msg->hdr.len;
+  kind = simFrameKind(msg->data, msg->hdr.len, &num);
+  if ((! isGateway(index)) && (kind == SIM_KIND_DATA)) {
+    uint32_t key = ((uint32_t)index << 16) | num;
+
+    if (_readings.find(key) == _readings.end()) {
+      reading_t &reading = _readings[key];
+
+      reading.sent = t;
+      reading.acked = false;
+      ++_stats.readings;
+    }
+  }
+
+  frame.hdr = msg->hdr;
+  memcpy(frame.hdr.mac, node.mac, sizeof(frame.hdr.mac));
+  frame.hdr.channel = ch;
+  memcpy(frame.data, msg->data, msg->hdr.len);
+
+  if (unicast) {
+    int16_t dst = nodeByMac(msg->hdr.mac);
+    bool ok = false;
+
+    if ((! isGateway(index)) && (dst >= 0) && isGateway(dst) && (! node.joined)) {
+      node.joined = true;
+      _joins.push_back(t - node.spawned_at);
+    }
+
+    for (uint8_t attempt = 0; attempt <= _config.retries; ++attempt) {
+      uint32_t air = airtime(msg->hdr.len, true);
+
+      ++_stats.tx_attempts;
+      t += air;
+      _stats.airtime[ch] += air;
+      if ((dst >= 0) && _nodes[dst].alive && (_nodes[dst].channel == ch) && (! lost())) {
+        ok = true;
+        break;
+      }
+      ++_stats.lost;
+    }
+    _busy[ch] = t;
+    if (ok) {
+      frame.hdr.rssi = rssi(index, dst);
+      schedule(t + _config.latency + (_config.jitter ? random() % _config.jitter : 0), EVT_DELIVER, dst, &frame);
+    }
+    frame.hdr.status = ok ? 0 : 1;
+    frame.hdr.len = 0;
+    memcpy(frame.hdr.mac, msg->hdr.mac, sizeof(frame.hdr.mac));
+    frame.hdr.type = SIM_TX_STATUS;
+    schedule(t, EVT_TX_STATUS, index, &frame);
+  } else {
+    uint32_t air = airtime(msg->hdr.len, false);
+
+    ++_stats.tx_attempts;
+    t += air;
+    _busy[ch] = t;
+    _stats.airtime[ch] += air;
+    // One event for all receivers, loss is decided per receiver on delivery
+    schedule(t + _config.latency + (_config.jitter ? random() % _config.jitter : 0), EVT_BROADCAST, index, &frame);
+    frame.hdr.status = 0;
+    frame.hdr.len = 0;
+    memcpy(frame.hdr.mac, BROADCAST, sizeof(frame.hdr.mac));
+    frame.hdr.type = SIM_TX_STATUS;
+    schedule(t, EVT_TX_STATUS, index, &frame);
+  }
+}
+
+void SimRadio::scan(uint16_t index, const sim_msg_t *msg) {
+  std::string ssid((const char*)msg->data, msg->hdr.len);
+  sim_msg_t result;
+  sim_ap_t *aps = (sim_ap_t*)result.data;
+  uint16_t count = 0;
+
+  memset(&result.hdr, 0, sizeof(result.hdr));
+  result.hdr.type = SIM_SCAN_RESULT;
+  for (uint16_t i = 0; i < _nodes.size(); ++i) {
+    const node_t &node = _nodes[i];
+
+    if ((i == index) || (! node.alive) || (! node.ap_channel))
+      continue;
+    if (msg->hdr.channel && (node.ap_channel != msg->hdr.channel))
+      continue;
+    if ((! ssid.empty()) && (node.ap_ssid != ssid))
+      continue;
+    if ((count + 1) * sizeof(sim_ap_t) > SIM_MAX_DATA)
+      break;
+    memcpy(aps[count].bssid, node.mac, sizeof(aps[count].bssid));
+    aps[count].channel = node.ap_channel;
+    aps[count].rssi = rssi(index, i);
+    ++count;
+  }
+  result.hdr.len = count * sizeof(sim_ap_t);
+  deliver(index, &result);
+}
+
+void SimRadio::receive(uint16_t index, const sim_msg_t *msg) {
+  node_t &node = _nodes[index];
+
+  switch (msg->hdr.type) {
+    case SIM_FRAME:
+      transmit(index, msg);
+      break;
+    case SIM_CHANNEL:
+      node.channel = msg->hdr.channel;
+      break;
+    case SIM_AP:
+      node.ap_channel = msg->hdr.channel;
+      node.ap_ssid.assign((const char*)msg->data, msg->hdr.len);
+      break;
+    case SIM_SCAN:
+      scan(index, msg);
+      break;
+    case SIM_PUBLISH:
+      ++_stats.publishes;
+      _stats.publish_bytes += msg->hdr.len;
+      break;
+    case SIM_SLEEP:
+      {
+        uint64_t us;
+
+        memcpy(&us, msg->data, sizeof(us));
+        node.wake_at = now() + us;
+        _stats.awake += now() - node.spawned_at;
+      }
+      break;
+    case SIM_RTC:
+      node.rtc.assign(msg->data, msg->data + std::min<uint16_t>(msg->hdr.len, SIM_RTC_SIZE));
+      node.rtc.resize(SIM_RTC_SIZE, 0);
+      break;
+    case SIM_COMMAND_RUN:
+      {
+        unsigned number;
+
+        if (sscanf(std::string((const char*)msg->data, msg->hdr.len).c_str(), "ping %u", &number) == 1) {
+          std::map<uint32_t, command_t>::iterator it = _commands.find(number);
+
+          if ((it != _commands.end()) && (it->second.node == index) && (it->second.runs < 0xFF)) {
+            if (++it->second.runs == 1)
+              ++_stats.commands_run;
+            else if (it->second.runs == 2)
+              ++_stats.commands_rerun;
+          }
+        }
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void SimRadio::arrive(uint16_t index, uint64_t time, const sim_msg_t *frame) {
+  uint16_t num;
+  sim_frame_kind_t kind = simFrameKind(frame->data, frame->hdr.len, &num);
+
+  ++_stats.delivered;
+  if (isGateway(index) && (kind == SIM_KIND_DATA)) {
+    ++_stats.gw_data;
+    ++_nodes[index].gw_data;
+  } else if ((! isGateway(index)) && (kind == SIM_KIND_ACK)) {
+    sim_ack_t acks[SIM_MAX_FRAME / sizeof(sim_ack_t)];
+    uint8_t count = simFrameAcks(frame->data, frame->hdr.len, acks, sizeof(acks) / sizeof(acks[0]));
+    const uint8_t *id = &_nodes[index].mac[3];
+
+    for (uint8_t i = 0; i < count; ++i) {
+      if ((acks[i].id[0] | acks[i].id[1] | acks[i].id[2]) && memcmp(acks[i].id, id, sizeof(acks[i].id)))
+        continue;
+
+      std::map<uint32_t, reading_t>::iterator it = _readings.find(((uint32_t)index << 16) | acks[i].num);
+
+      if ((it != _readings.end()) && (! it->second.acked) && (time >= it->second.sent)) {
+        _latencies.push_back(time - it->second.sent);
+        it->second.acked = true;
+        ++_stats.acked;
+      }
+    }
+
+    const uint8_t *data;
+    uint8_t len = simFrameCommand(frame->data, frame->hdr.len, &data);
+    unsigned number;
+
+    if (len && (sscanf(std::string((const char*)data, len).c_str(), "ping %u", &number) == 1)) {
+      std::map<uint32_t, command_t>::iterator it = _commands.find(number);
+
+      if ((it != _commands.end()) && (it->second.node == index) && (! it->second.delivered)) {
+        _command_latencies.push_back(time - it->second.sent);
+        it->second.delivered = true;
+        ++_stats.commands_delivered;
+      }
+    }
+  }
+  deliver(index, frame);
+}
+
+void SimRadio::command(uint64_t time) {
+  std::vector<uint16_t> alive;
+  sim_msg_t msg;
+  char payload[16];
+  uint16_t len;
+  command_t &cmd = _commands[_stats.commands];
+
+  for (uint16_t i = _config.gateways; i < _nodes.size(); ++i) {
+    if (_nodes[i].alive || (_nodes[i].sleeps && (! _nodes[i].halted))) // Gateway holds it for a sleeper until it wakes
+      alive.push_back(i);
+  }
+  if (alive.empty()) {
+    _commands.erase(_stats.commands);
+    return;
+  }
+  cmd.node = alive[random() % alive.size()];
+  cmd.sent = time;
+  cmd.delivered = false;
+  cmd.runs = 0;
+  memset(&msg.hdr, 0, sizeof(msg.hdr));
+  msg.hdr.type = SIM_MQTT_MESSAGE;
+  simCommandTopic(_nodes[cmd.node].mac, (char*)msg.data, 64);
+  len = strlen((const char*)msg.data) + 1;
+  snprintf(payload, sizeof(payload), "ping %u", _stats.commands++);
+  memcpy(&msg.data[len], payload, strlen(payload));
+  msg.hdr.len = len + strlen(payload);
+  for (uint16_t i = 0; i < _config.gateways; ++i) { // All of them subscribe to commands
+    deliver(i, &msg);
+  }
+}
+
+void SimRadio::powerOff(uint16_t index) {
+  node_t &node = _nodes[index];
+
+  if (! node.alive)
+    return;
+  kill(node.pid, SIGKILL);
+  waitpid(node.pid, NULL, 0);
+  close(node.fd);
+  node.fd = -1;
+  node.alive = false;
+  node.ap_channel = 0;
+  node.halted = true;
+}
+
+void SimRadio::process(const event_t &e) {
+  switch (e.kind) {
+    case EVT_DELIVER:
+      if (_nodes[e.node].alive && (_nodes[e.node].channel == e.msg.hdr.channel))
+        arrive(e.node, e.time, &e.msg);
+      break;
+    case EVT_BROADCAST:
+      {
+        sim_msg_t frame = e.msg;
+
+        for (uint16_t i = 0; i < _nodes.size(); ++i) {
+          if ((i == e.node) || (! _nodes[i].alive) || (_nodes[i].channel != frame.hdr.channel))
+            continue;
+          if (lost()) {
+            ++_stats.lost;
+            continue;
+          }
+          frame.hdr.rssi = rssi(e.node, i);
+          arrive(i, e.time, &frame);
+        }
+      }
+      break;
+    case EVT_TX_STATUS:
+      deliver(e.node, &e.msg);
+      break;
+    case EVT_SPAWN:
+      spawn(e.node);
+      break;
+    case EVT_WIFI_DROP:
+      {
+        sim_msg_t msg;
+
+        memset(&msg.hdr, 0, sizeof(msg.hdr));
+        msg.hdr.type = SIM_WIFI_DROP;
+        msg.hdr.len = sizeof(_config.wifi_drop_time);
+        memcpy(msg.data, &_config.wifi_drop_time, sizeof(_config.wifi_drop_time));
+        deliver(e.node, &msg);
+        ++_stats.wifi_drops;
+        schedule(e.time + (uint64_t)_config.wifi_drop_period * 1000, EVT_WIFI_DROP, e.node);
+      }
+      break;
+    case EVT_COMMAND:
+      command(e.time);
+      schedule(e.time + (uint64_t)_config.command_period * 1000, EVT_COMMAND, 0);
+      break;
+    case EVT_POWER_OFF:
+      powerOff(e.node);
+      break;
+  }
+}
+
+void SimRadio::run() {
+  std::vector<struct pollfd> pfds;
+  std::vector<uint16_t> owners;
+  uint64_t end;
+
+  _start = now();
+  end = _start + (uint64_t)_config.duration * 1000;
+  for (uint16_t i = 0; i < _config.gateways; ++i) {
+    schedule(_start, EVT_SPAWN, i);
+  }
+  for (uint16_t i = 0; i < _config.clients; ++i) {
+    schedule(_start + (uint64_t)_config.ramp * 1000 * i / _config.clients, EVT_SPAWN, _config.gateways + i);
+  }
+  if (_config.wifi_drop_period)
+    schedule(_start + (uint64_t)_config.wifi_drop_period * 1000, EVT_WIFI_DROP, 0);
+  if (_config.command_period)
+    schedule(_start + (uint64_t)_config.command_period * 1000, EVT_COMMAND, 0);
+  if (_config.power_off)
+    schedule(_start + (uint64_t)_config.power_off * 1000, EVT_POWER_OFF, 0);
+
+  for (;;) {
+    uint64_t t = now();
+    uint64_t wait;
+    struct timespec ts;
+
+    while ((! _events.empty()) && (_events.top().time <= t)) {
+      event_t e = _events.top();
+
+      _events.pop();
+      if (t - e.time > _stats.max_lag)
+        _stats.max_lag = t - e.time;
+      process(e);
+    }
+    if (t >= end)
+      break;
+    wait = end - t;
+    if ((! _events.empty()) && (_events.top().time - t < wait))
+      wait = _events.top().time - t;
+
+    pfds.clear();
+    owners.clear();
+    for (uint16_t i = 0; i < _nodes.size(); ++i) {
+      if (_nodes[i].alive) {
+        struct pollfd pfd;
+
+        pfd.fd = _nodes[i].fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        pfds.push_back(pfd);
+        owners.push_back(i);
+      }
+    }
+    ts.tv_sec = wait / 1000000;
+    ts.tv_nsec = (wait % 1000000) * 1000;
+    if (ppoll(pfds.data(), pfds.size(), &ts, NULL) <= 0)
+      continue;
+    for (size_t i = 0; i < pfds.size(); ++i) {
+      if (pfds[i].revents & POLLIN) {
+        sim_msg_t msg;
+        ssize_t len;
+
+        while ((len = recv(pfds[i].fd, &msg, sizeof(msg), MSG_DONTWAIT)) >= (ssize_t)sizeof(msg.hdr)) {
+          receive(owners[i], &msg);
+        }
+        if (len == 0) {
+          reap(owners[i]);
+          continue;
+        }
+      }
+      if (pfds[i].revents & (POLLHUP | POLLERR))
+        reap(owners[i]);
+    }
+  }
+  _elapsed = now() - _start;
+  for (uint16_t i = 0; i < _nodes.size(); ++i) {
+    if (_nodes[i].alive) {
+      kill(_nodes[i].pid, SIGKILL);
+      waitpid(_nodes[i].pid, NULL, 0);
+      close(_nodes[i].fd);
+      _nodes[i].fd = -1;
+      _nodes[i].alive = false;
+    }
+  }
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, double p) {
+  if (sorted.empty())
+    return 0;
+
+  size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+
+  return sorted[i];
+}
+
+void SimRadio::report() const {
+  double seconds = _elapsed / 1000000.0;
+  std::vector<uint32_t> latencies(_latencies);
+  std::vector<uint32_t> command_latencies(_command_latencies);
+  std::vector<uint32_t> joins(_joins);
+  uint32_t restarts = 0, sleeps = 0, halted = 0, gw_restarts = 0;
+
+  if (seconds <= 0)
+    return;
+  std::sort(latencies.begin(), latencies.end());
+  std::sort(command_latencies.begin(), command_latencies.end());
+  std::sort(joins.begin(), joins.end());
+  for (uint16_t i = 0; i < _config.gateways; ++i) {
+    gw_restarts += _nodes[i].restarts;
+  }
+  for (uint16_t i = _config.gateways; i < _nodes.size(); ++i) {
+    restarts += _nodes[i].restarts;
+    sleeps += _nodes[i].sleeps;
+    if (_nodes[i].halted)
+      ++halted;
+  }
+
+  printf("\n=== %u gateway(s) + %u clients, %.1f s, loss %.3f, latency %u+%u us, %.1f Mbps, %u retries ===\n",
+    _config.gateways, _config.clients, seconds, _config.loss, _config.latency, _config.jitter, _config.rate, _config.retries);
+  printf("Radio:   %llu frames (%llu attempts, %llu bytes), %llu delivered, %llu lost, %llu rx overflows\n",
+    (unsigned long long)_stats.tx_frames, (unsigned long long)_stats.tx_attempts, (unsigned long long)_stats.tx_bytes,
+    (unsigned long long)_stats.delivered, (unsigned long long)_stats.lost, (unsigned long long)_stats.rx_overflows);
+  for (uint8_t ch = 1; ch < CHANNELS; ++ch) {
+    if (_stats.airtime[ch])
+      printf("         channel %u airtime %.2f%%\n", ch, _stats.airtime[ch] * 100.0 / _elapsed);
+  }
+  printf("Gateway: %llu DATA frames received, %llu MQTT publishes (%.1f/s, %llu bytes), %u WiFi drops, %u restarts\n",
+    (unsigned long long)_stats.gw_data, (unsigned long long)_stats.publishes, _stats.publishes / seconds,
+    (unsigned long long)_stats.publish_bytes, _stats.wifi_drops, gw_restarts);
+  if (_config.gateways > 1) {
+    printf("        ");
+    for (uint16_t i = 0; i < _config.gateways; ++i) {
+      printf(" gw%u %llu%s", i, (unsigned long long)_nodes[i].gw_data, _nodes[i].halted ? " (off)" : "");
+    }
+    printf(" DATA frames\n");
+  }
+  printf("Clients: %llu DATA frames sent (%.1f/s), %llu acked (%.1f%%), %lu unacked, %u restarts, %u deep sleeps, %u halted\n",
+    (unsigned long long)_stats.readings, _stats.readings / seconds, (unsigned long long)_stats.acked,
+    _stats.readings ? _stats.acked * 100.0 / _stats.readings : 0.0, (unsigned long)(_stats.readings - _stats.acked), restarts, sleeps, halted);
+  if (sleeps)
+    printf("Sleepers: %u deep sleeps, awake %.1f ms per wake\n", sleeps, _stats.awake / 1000.0 / sleeps);
+  if (! joins.empty())
+    printf("Join:    %u boots, first frame to gateway after p50 %.1f ms, p90 %.1f ms, max %.1f ms\n", (unsigned)joins.size(),
+      percentile(joins, 0.5) / 1000.0, percentile(joins, 0.9) / 1000.0, joins.back() / 1000.0);
+  printf("ACK latency: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+    percentile(latencies, 0.5) / 1000.0, percentile(latencies, 0.9) / 1000.0, percentile(latencies, 0.99) / 1000.0,
+    latencies.empty() ? 0.0 : latencies.back() / 1000.0);
+  if (_stats.commands)
+    printf("Commands: %u sent, %u delivered (%.1f%%), latency p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+      _stats.commands, _stats.commands_delivered, _stats.commands_delivered * 100.0 / _stats.commands,
+      percentile(command_latencies, 0.5) / 1000.0, percentile(command_latencies, 0.9) / 1000.0,
+      percentile(command_latencies, 0.99) / 1000.0, command_latencies.empty() ? 0.0 : command_latencies.back() / 1000.0);
+  if (_stats.commands)
+    printf("         %u run by client, %u run more than once\n", _stats.commands_run, _stats.commands_rerun);
+  printf("Hub lag: max %.2f ms\n", _stats.max_lag / 1000.0);
+  if (_stats.crashes)
+    printf("WARNING: %u node crashes\n", _stats.crashes);
+}
@@ -0,0 +1,157 @@
+#ifndef __SIMRADIO_H
+#define __SIMRADIO_H
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+#include "SimProtocol.h"
+
+struct sim_config_t {
+  uint16_t gateways; // First nodes
+  uint16_t clients;
+  uint16_t sleepers; // First clients run deep sleep firmware
+  uint32_t duration; // ms.
+  uint32_t ramp; // ms. to boot all clients
+  double loss; // Per transmission attempt (0..1)
+  uint32_t latency; // us. added to every delivery
+  uint32_t jitter; // us. random extra delivery delay
+  double rate; // Mbps
+  uint8_t retries; // MAC level retries of unicast frames
+  uint8_t channel; // WiFi router channel
+  uint32_t wifi_drop_period; // ms. between gateway station link drops (0 = never)
+  uint32_t wifi_drop_time; // ms. of every drop
+  uint32_t power_off; // ms. when first gateway is switched off for good (0 = never)
+  uint32_t command_period; // ms. between MQTT commands to a random client (0 = none)
+  uint64_t seed;
+  uint8_t verbose; // 0 = quiet, 1 = gateway log, 2 = all nodes log
+};
+
+/*
+ * Radio hub: owns the node processes and models the shared medium. Each channel
+ * is a single collision free medium, frames are serialized on it and occupy
+ * airtime derived from the PHY rate, then are delivered with configured loss
+ * and latency. Every node runs in its own subdirectory of a temporary directory,
+ * which stands for its flash file system and survives its restarts.
+ */
+class SimRadio {
+public:
+  SimRadio(const sim_config_t &config);
+  ~SimRadio();
+
+  void run();
+  void report() const;
+
+protected:
+  static const uint8_t CHANNELS = 14;
+  static const uint32_t BOOT_TIME = 250; // ms. from restart to setup()
+
+  enum event_kind_t { EVT_DELIVER, EVT_BROADCAST, EVT_TX_STATUS, EVT_SPAWN, EVT_WIFI_DROP, EVT_COMMAND, EVT_POWER_OFF };
+
+  struct node_t {
+    pid_t pid;
+    int fd;
+    uint8_t mac[6];
+    uint8_t channel;
+    uint8_t ap_channel; // 0 = soft AP is down
+    std::string ap_ssid;
+    bool alive;
+    bool halted;
+    uint32_t restarts;
+    uint32_t sleeps;
+    uint64_t wake_at;
+    uint64_t spawned_at;
+    bool joined; // Sent a frame to gateway since spawn
+    uint64_t gw_data; // DATA frames received by gateway
+    std::vector<uint8_t> rtc; // RTC user memory
+  };
+
+  struct event_t {
+    uint64_t time;
+    uint32_t seq;
+    event_kind_t kind;
+    uint16_t node;
+    sim_msg_t msg;
+
+    bool operator<(const event_t &e) const {
+      return (time > e.time) || ((time == e.time) && (seq > e.seq));
+    }
+  };
+
+  struct reading_t {
+    uint64_t sent; // First DATA (or BATCH) transmit time
+    bool acked;
+  };
+
+  struct command_t {
+    uint16_t node;
+    uint64_t sent; // Published to gateway
+    bool delivered;
+    uint8_t runs; // Times the client executed it
+  };
+
+  struct stats_t {
+    uint64_t tx_frames;
+    uint64_t tx_attempts;
+    uint64_t tx_bytes;
+    uint64_t delivered;
+    uint64_t lost;
+    uint64_t rx_overflows;
+    uint64_t airtime[CHANNELS];
+    uint64_t gw_data;
+    uint64_t publishes;
+    uint64_t publish_bytes;
+    uint64_t readings;
+    uint64_t acked;
+    uint32_t crashes;
+    uint32_t wifi_drops;
+    uint32_t commands;
+    uint32_t commands_delivered;
+    uint32_t commands_run; // Executed by the client at least once
+    uint32_t commands_rerun; // Executed more than once
+    uint64_t awake; // us. of clients from boot to deep sleep
+    uint64_t max_lag; // us. worst event processing delay of the hub itself
+  };
+
+  bool isGateway(uint16_t index) const {
+    return index < _config.gateways;
+  }
+  uint64_t now() const;
+  uint64_t random();
+  bool lost();
+  uint32_t airtime(uint8_t len, bool unicast) const;
+  int8_t rssi(uint16_t a, uint16_t b) const;
+  int16_t nodeByMac(const uint8_t *mac) const;
+
+  void schedule(uint64_t time, event_kind_t kind, uint16_t node, const sim_msg_t *msg = NULL);
+  bool spawn(uint16_t index);
+  void reap(uint16_t index);
+  void deliver(uint16_t index, const sim_msg_t *msg);
+  void transmit(uint16_t index, const sim_msg_t *msg);
+  void arrive(uint16_t index, uint64_t time, const sim_msg_t *frame);
+  void scan(uint16_t index, const sim_msg_t *msg);
+  void receive(uint16_t index, const sim_msg_t *msg);
+  void process(const event_t &e);
+  void command(uint64_t time);
+  void powerOff(uint16_t index);
+
+  sim_config_t _config;
+  std::vector<node_t> _nodes;
+  std::priority_queue<event_t> _events;
+  uint32_t _seq;
+  uint64_t _start;
+  uint64_t _elapsed;
+  uint64_t _random;
+  uint64_t _busy[CHANNELS]; // Medium is busy until
+  std::map<uint32_t, reading_t> _readings; // (node << 16 | num)
+  std::vector<uint32_t> _latencies; // us.
+  std::map<uint32_t, command_t> _commands; // By number in payload
+  std::vector<uint32_t> _command_latencies; // us.
+  std::vector<uint32_t> _joins; // us. from client spawn to its first frame to gateway
+  stats_t _stats;
+  std::string _flash; // Temporary directory with flash file system of every node
+};
+
+#endif
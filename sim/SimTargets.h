@@ -0,0 +1,36 @@
+#ifndef __SIMTARGETS_H
+#define __SIMTARGETS_H
+
+#include <inttypes.h>
+
+/*
+ * Entry points of src/main.cpp built as gateway (SERVER) and as client, each
+ * wrapped in its own namespace (see gateway.cpp, client.cpp and sleeper.cpp).
+ */
+
+void simGatewaySetup();
+void simGatewayLoop();
+
+void simClientSetup();
+void simClientLoop();
+
+void simSleeperSetup(); // Client built with DEEP_SLEEP
+void simSleeperLoop();
+
+enum sim_frame_kind_t { SIM_KIND_OTHER, SIM_KIND_DATA, SIM_KIND_ACK };
+
+struct sim_ack_t {
+  uint8_t id[3]; // 3 lower bytes of acked client MAC, all zero for unicast ACK
+  uint16_t num;
+};
+
+// Classify an ESP-NOW frame of the project protocol for latency accounting
+sim_frame_kind_t simFrameKind(const uint8_t *data, uint8_t len, uint16_t *num);
+// Extract acknowledged sequence numbers from an ACK frame
+uint8_t simFrameAcks(const uint8_t *data, uint8_t len, sim_ack_t *acks, uint8_t max);
+// Downlink command carried by an ACK frame, 0 if none
+uint8_t simFrameCommand(const uint8_t *data, uint8_t len, const uint8_t **command);
+// MQTT topic the gateway takes commands for node of this MAC from
+void simCommandTopic(const uint8_t *mac, char *topic, uint8_t size);
+
+#endif
@@ -0,0 +1,15 @@
+#include "SimPrelude.h"
+
+#define CLIENT
+
+namespace client {
+#include "../src/main.cpp"
+}
+
+void simClientSetup() {
+  client::setup();
+}
+
+void simClientLoop() {
+  client::loop();
+}
@@ -0,0 +1,75 @@
+#include "SimPrelude.h"
+
+namespace gateway {
+#include "../src/main.cpp"
+}
+
+void simGatewaySetup() {
+  gateway::setup();
+}
+
+void simGatewayLoop() {
+  gateway::loop();
+}
+
+sim_frame_kind_t simFrameKind(const uint8_t *data, uint8_t len, uint16_t *num) {
+  const gateway::espnow_header_t *header = (const gateway::espnow_header_t*)data;
+
+  if ((len < sizeof(gateway::espnow_header_t)) || (header->magic != gateway::ESPNOW_MAGIC))
+    return SIM_KIND_OTHER;
+  *num = header->num;
+  if ((header->type == gateway::ESPNOW_DATA) && (len == sizeof(gateway::espnow_data_t)))
+    return SIM_KIND_DATA;
+  if ((header->type == gateway::ESPNOW_ACK) && (len <= sizeof(gateway::espnow_command_t)))
+    return SIM_KIND_ACK;
+  if (header->type == gateway::ESPNOW_ACKS)
+    return SIM_KIND_ACK;
+  if (((header->type == gateway::ESPNOW_BATCH) || (header->type == gateway::ESPNOW_TLV) ||
+    (header->type == gateway::ESPNOW_FRAG)) && (len > sizeof(gateway::espnow_header_t)))
+    return SIM_KIND_DATA;
+
+  return SIM_KIND_OTHER;
+}
+
+uint8_t simFrameAcks(const uint8_t *data, uint8_t len, sim_ack_t *acks, uint8_t max) {
+  const gateway::espnow_header_t *header = (const gateway::espnow_header_t*)data;
+  uint8_t count = 0;
+
+  if ((len < sizeof(gateway::espnow_header_t)) || (header->magic != gateway::ESPNOW_MAGIC))
+    return 0;
+  if ((header->type == gateway::ESPNOW_ACK) && (len <= sizeof(gateway::espnow_command_t)) && max) {
+    memset(acks[0].id, 0, sizeof(acks[0].id));
+    acks[0].num = header->num;
+    return 1;
+  }
+  if (header->type == gateway::ESPNOW_ACKS) {
+    const gateway::espnow_ack_t *items = ((const gateway::espnow_acks_t*)data)->acks;
+
+    while ((count < max) && (sizeof(gateway::espnow_header_t) + (count + 1) * sizeof(gateway::espnow_ack_t) <= len)) {
+      memcpy(acks[count].id, items[count].id, sizeof(acks[count].id));
+      acks[count].num = items[count].num;
+      ++count;
+    }
+  }
+
+  return count;
+}
+
+uint8_t simFrameCommand(const uint8_t *data, uint8_t len, const uint8_t **command) {
+  const gateway::espnow_command_t *ack = (const gateway::espnow_command_t*)data;
+
+  if ((len <= sizeof(gateway::espnow_header_t) + 1) || (len > sizeof(gateway::espnow_command_t)) ||
+    (ack->header.magic != gateway::ESPNOW_MAGIC) || (ack->header.type != gateway::ESPNOW_ACK))
+    return 0;
+  *command = ack->data;
+
+  return len - sizeof(gateway::espnow_header_t) - 1;
+}
+
+void simCommandTopic(const uint8_t *mac, char *topic, uint8_t size) {
+  char id[9];
+
+  gateway::idToTopic(id, gateway::macToId(mac));
+  id[8] = '\0';
+  snprintf(topic, size, "%s%s%s", gateway::MQTT_PREFIX, gateway::MQTT_COMMAND_TOPIC, id);
+}
@@ -0,0 +1,223 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+/*
+ * Minimal host-side Arduino core used by the network simulator. Only the part
+ * of the ESP8266 core API touched by this project is provided.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+#include "pgmspace.h"
+
+#ifndef __packed
+#define __packed __attribute__((packed))
+#endif
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+#define ICACHE_FLASH_ATTR
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x00
+#define INPUT_PULLUP 0x02
+#define OUTPUT 0x01
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define SERIAL_8N1 0x1c
+#define SERIAL_FULL 0
+#define SERIAL_RX_ONLY 1
+#define SERIAL_TX_ONLY 2
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+class __FlashStringHelper;
+#define FPSTR(pstr_pointer) (reinterpret_cast<const __FlashStringHelper*>(pstr_pointer))
+#define F(string_literal) (FPSTR(PSTR(string_literal)))
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+
+void attachInterrupt(uint8_t pin, void (*userFunc)(void), int mode);
+void detachInterrupt(uint8_t pin);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+
+char *ultoa(unsigned long value, char *result, int base);
+char *ltoa(long value, char *result, int base);
+char *utoa(unsigned int value, char *result, int base);
+char *itoa(int value, char *result, int base);
+
+class String {
+public:
+  String(const char *cstr = "") : _str(cstr ? cstr : "") {}
+  String(const __FlashStringHelper *str) : _str((const char*)str) {}
+  String(char c) : _str(1, c) {}
+  String(int value, unsigned char base = 10);
+  String(unsigned int value, unsigned char base = 10);
+  String(long value, unsigned char base = 10);
+  String(unsigned long value, unsigned char base = 10);
+
+  unsigned int length() const {
+    return _str.length();
+  }
+  const char *c_str() const {
+    return _str.c_str();
+  }
+  String &operator+=(const String &rhs) {
+    _str += rhs._str;
+    return *this;
+  }
+  String &operator+=(const char *cstr) {
+    _str += cstr;
+    return *this;
+  }
+  String &operator+=(char c) {
+    _str += c;
+    return *this;
+  }
+  bool operator==(const String &rhs) const {
+    return _str == rhs._str;
+  }
+  bool operator==(const char *cstr) const {
+    return _str == cstr;
+  }
+
+protected:
+  std::string _str;
+};
+
+class Print;
+
+class Printable {
+public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print &p) const = 0;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *str) {
+    return str ? write((const uint8_t*)str, strlen(str)) : 0;
+  }
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  size_t printf_P(PGM_P format, ...) __attribute__((format(printf, 2, 3)));
+
+  size_t print(const __FlashStringHelper *str) {
+    return write((const char*)str);
+  }
+  size_t print(const String &str) {
+    return write(str.c_str());
+  }
+  size_t print(const char str[]) {
+    return write(str);
+  }
+  size_t print(char c) {
+    return write((uint8_t)c);
+  }
+  size_t print(unsigned char value, int base = DEC) {
+    return print((unsigned long)value, base);
+  }
+  size_t print(int value, int base = DEC) {
+    return print((long)value, base);
+  }
+  size_t print(unsigned int value, int base = DEC) {
+    return print((unsigned long)value, base);
+  }
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+  size_t print(const Printable &p) {
+    return p.printTo(*this);
+  }
+
+  template<typename T> size_t println(const T &value) {
+    size_t n = print(value);
+    return n + println();
+  }
+  template<typename T> size_t println(const T &value, int base) {
+    size_t n = print(value, base);
+    return n + println();
+  }
+  size_t println(const char str[]) {
+    size_t n = print(str);
+    return n + println();
+  }
+  size_t println() {
+    return write((const uint8_t*)"\r\n", 2);
+  }
+};
+
+class HardwareSerial : public Print {
+public:
+  HardwareSerial() : _bol(true) {}
+
+  void begin(unsigned long baud, int config = SERIAL_8N1, int mode = SERIAL_FULL) {}
+  void end() {}
+  int available() {
+    return 0;
+  }
+  int read() {
+    return -1;
+  }
+  void flush();
+  size_t write(uint8_t c);
+  size_t write(const uint8_t *buffer, size_t size);
+  using Print::write;
+
+protected:
+  bool _bol;
+};
+
+extern HardwareSerial Serial;
+
+enum RFMode { RF_DEFAULT = 0, RF_CAL = 1, RF_NO_CAL = 2, RF_DISABLED = 4 };
+
+class EspClass {
+public:
+  uint32_t getChipId();
+  const char *getSdkVersion() {
+    return "sim";
+  }
+  uint32_t getFreeHeap();
+  uint32_t getCycleCount() {
+    return micros() * 80;
+  }
+  void restart() __attribute__((noreturn));
+  void reset() __attribute__((noreturn)) {
+    restart();
+  }
+  void deepSleep(uint64_t time_us, RFMode mode = RF_DEFAULT) __attribute__((noreturn));
+  bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size); // offset in 4 byte blocks
+  bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size);
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef ASYNCMQTTCLIENT_H_
+#define ASYNCMQTTCLIENT_H_
+
+/*
+ * Host replacement of AsyncMqttClient. The broker is emulated by the simulator,
+ * every accepted publish is reported to the radio hub for throughput accounting.
+ */
+
+#include <functional>
+#include <Arduino.h>
+
+enum class AsyncMqttClientDisconnectReason : int8_t {
+  TCP_DISCONNECTED = 0,
+  MQTT_SERVER_UNAVAILABLE = 3
+};
+
+struct AsyncMqttClientMessageProperties {
+  uint8_t qos;
+  bool dup;
+  bool retain;
+};
+
+class AsyncMqttClient {
+public:
+  typedef std::function<void(bool sessionPresent)> OnConnectUserCallback;
+  typedef std::function<void(AsyncMqttClientDisconnectReason reason)> OnDisconnectUserCallback;
+  typedef std::function<void(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total)> OnMessageUserCallback;
+
+  AsyncMqttClient();
+  ~AsyncMqttClient();
+
+  AsyncMqttClient &setServer(const char *host, uint16_t port) {
+    return *this;
+  }
+  AsyncMqttClient &setClientId(const char *clientId) {
+    return *this;
+  }
+  AsyncMqttClient &setCredentials(const char *username, const char *password = NULL) {
+    return *this;
+  }
+  AsyncMqttClient &setKeepAlive(uint16_t keepAlive) {
+    return *this;
+  }
+  AsyncMqttClient &onConnect(OnConnectUserCallback callback) {
+    _onConnect = callback;
+    return *this;
+  }
+  AsyncMqttClient &onDisconnect(OnDisconnectUserCallback callback) {
+    _onDisconnect = callback;
+    return *this;
+  }
+  AsyncMqttClient &onMessage(OnMessageUserCallback callback) {
+    _onMessage = callback;
+    return *this;
+  }
+
+  bool connected() const {
+    return _connected;
+  }
+  void connect();
+  void disconnect(bool force = false);
+  uint16_t subscribe(const char *topic, uint8_t qos);
+  uint16_t unsubscribe(const char *topic);
+  uint16_t publish(const char *topic, uint8_t qos, bool retain, const char *payload = NULL, size_t length = 0, bool dup = false, uint16_t message_id = 0);
+
+  // Driven by the simulator runtime
+  void _poll();
+  void _drop();
+  void _message(char *topic, char *payload, size_t len);
+
+protected:
+  OnConnectUserCallback _onConnect;
+  OnDisconnectUserCallback _onDisconnect;
+  OnMessageUserCallback _onMessage;
+  bool _connected;
+  bool _connecting;
+  uint32_t _connectAt;
+  uint16_t _nextPacketId;
+};
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef ESP8266WiFi_h
+#define ESP8266WiFi_h
+
+/*
+ * Host replacement of the ESP8266WiFi library. Station connection, soft AP and
+ * scan are emulated by the simulator (see sim/SimNode.cpp).
+ */
+
+#include <functional>
+#include <memory>
+#include <Arduino.h>
+
+enum WiFiMode_t { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 };
+
+enum WiFiDisconnectReason {
+  WIFI_DISCONNECT_REASON_UNSPECIFIED = 1,
+  WIFI_DISCONNECT_REASON_BEACON_TIMEOUT = 200,
+  WIFI_DISCONNECT_REASON_NO_AP_FOUND = 201
+};
+
+class IPAddress : public Printable {
+public:
+  IPAddress(uint32_t address = 0) : _address(address) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+
+  operator uint32_t() const {
+    return _address;
+  }
+  String toString() const;
+  size_t printTo(Print &p) const;
+
+protected:
+  uint32_t _address;
+};
+
+struct WiFiEventStationModeGotIP {
+  IPAddress ip;
+  IPAddress mask;
+  IPAddress gw;
+};
+
+struct WiFiEventStationModeDisconnected {
+  String ssid;
+  uint8_t bssid[6];
+  WiFiDisconnectReason reason;
+};
+
+struct WiFiEventHandlerOpaque;
+typedef std::shared_ptr<WiFiEventHandlerOpaque> WiFiEventHandler;
+
+class ESP8266WiFiClass {
+public:
+  void persistent(bool persistent) {}
+  bool mode(WiFiMode_t mode);
+  WiFiMode_t getMode();
+
+  int begin(const char *ssid, const char *passphrase = NULL, int32_t channel = 0, const uint8_t *bssid = NULL, bool connect = true);
+  bool disconnect(bool wifioff = false);
+  bool isConnected();
+  IPAddress localIP();
+  uint8_t *macAddress(uint8_t *mac);
+  String macAddress();
+  int32_t channel();
+  int32_t RSSI();
+
+  bool softAP(const char *ssid, const char *passphrase = NULL, int channel = 1, int ssid_hidden = 0, int max_connection = 4);
+  bool softAPdisconnect(bool wifioff = false);
+  uint8_t *softAPmacAddress(uint8_t *mac);
+
+  int8_t scanNetworks(bool async = false, bool show_hidden = false, uint8_t channel = 0, uint8_t *ssid = NULL);
+  void scanDelete();
+  int32_t channel(uint8_t networkItem);
+  uint8_t *BSSID(uint8_t networkItem);
+  int32_t RSSI(uint8_t networkItem);
+
+  WiFiEventHandler onStationModeGotIP(std::function<void(const WiFiEventStationModeGotIP&)> f);
+  WiFiEventHandler onStationModeDisconnected(std::function<void(const WiFiEventStationModeDisconnected&)> f);
+};
+
+extern ESP8266WiFiClass WiFi;
+
+bool wifi_set_channel(uint8_t channel);
+uint8_t wifi_get_channel(void);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef FUNCTIONALINTERRUPT_H
+#define FUNCTIONALINTERRUPT_H
+
+#include <functional>
+#include <Arduino.h>
+
+void attachInterrupt(uint8_t pin, std::function<void(void)> intRoutine, int mode);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef __ESPNOW_H__
+#define __ESPNOW_H__
+
+#include <inttypes.h>
+
+/*
+ * Host replacement of the ESP8266 SDK ESP-NOW API. Frames go to the simulated
+ * radio (see sim/SimNode.cpp), callbacks are fired from delay()/yield() like
+ * the SDK does from the system task.
+ */
+
+enum esp_now_role {
+  ESP_NOW_ROLE_IDLE = 0,
+  ESP_NOW_ROLE_CONTROLLER,
+  ESP_NOW_ROLE_SLAVE,
+  ESP_NOW_ROLE_COMBO,
+  ESP_NOW_ROLE_MAX
+};
+
+typedef void (*esp_now_recv_cb_t)(uint8_t *mac, uint8_t *data, uint8_t len);
+typedef void (*esp_now_send_cb_t)(uint8_t *mac, uint8_t status);
+
+int esp_now_init(void);
+int esp_now_deinit(void);
+
+int esp_now_register_send_cb(esp_now_send_cb_t cb);
+int esp_now_unregister_send_cb(void);
+
+int esp_now_register_recv_cb(esp_now_recv_cb_t cb);
+int esp_now_unregister_recv_cb(void);
+
+int esp_now_send(uint8_t *da, uint8_t *data, int len);
+
+int esp_now_add_peer(uint8_t *mac, uint8_t role, uint8_t channel, uint8_t *key, uint8_t key_len);
+int esp_now_del_peer(uint8_t *mac);
+
+int esp_now_set_self_role(uint8_t role);
+int esp_now_get_self_role(void);
+
+int esp_now_set_peer_role(uint8_t *mac, uint8_t role);
+int esp_now_get_peer_role(uint8_t *mac);
+
+int esp_now_set_peer_channel(uint8_t *mac, uint8_t channel);
+int esp_now_get_peer_channel(uint8_t *mac);
+
+int esp_now_set_peer_key(uint8_t *mac, uint8_t *key, uint8_t key_len);
+int esp_now_get_peer_key(uint8_t *mac, uint8_t *key, uint8_t *key_len);
+
+uint8_t *esp_now_fetch_peer(bool restart);
+
+int esp_now_is_peer_exist(uint8_t *mac);
+
+int esp_now_get_cnt_info(uint8_t *all_cnt, uint8_t *encrypt_cnt);
+
+int esp_now_set_kok(uint8_t *key, uint8_t len);
+
+#endif
@@ -0,0 +1,125 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "SimRadio.h"
+
+/*
+ * ESP-NOW network simulator: runs the real gateway and client firmware from
+ * src/main.cpp as separate processes over a simulated radio.
+ */
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [options]\n"
+    "  -g <gateways>   number of gateway nodes (default 1)\n"
+    "  -n <clients>    number of client nodes (default 10)\n"
+    "  -S <clients>    how many of them run deep sleep firmware (default 0)\n"
+    "  -t <seconds>    simulated time (default 30)\n"
+    "  -R <ms>         spread client boots over this time (default 1000)\n"
+    "  -l <loss>       frame loss probability per attempt 0..1 (default 0)\n"
+    "  -d <us>         delivery latency (default 0)\n"
+    "  -j <us>         delivery jitter (default 0)\n"
+    "  -r <Mbps>       PHY rate (default 1)\n"
+    "  -m <retries>    MAC retries of unicast frames (default 0)\n"
+    "  -c <channel>    WiFi router channel (default 6)\n"
+    "  -w <s>[:<ms>]   drop first gateway WiFi every <s> seconds for <ms> (default 1000 ms.)\n"
+    "  -k <s>          switch the first gateway off after <s> seconds\n"
+    "  -C <ms>         publish an MQTT command to a random client every <ms>\n"
+    "  -s <seed>       random seed\n"
+    "  -v              log gateway serial output (-vv for all nodes)\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  sim_config_t config;
+  int opt;
+
+  config.gateways = 1;
+  config.clients = 10;
+  config.sleepers = 0;
+  config.duration = 30000;
+  config.ramp = 1000;
+  config.loss = 0;
+  config.latency = 0;
+  config.jitter = 0;
+  config.rate = 1;
+  config.retries = 0;
+  config.channel = 6;
+  config.wifi_drop_period = 0;
+  config.wifi_drop_time = 1000;
+  config.power_off = 0;
+  config.command_period = 0;
+  config.seed = 0;
+  config.verbose = 0;
+
+  while ((opt = getopt(argc, argv, "g:n:S:t:R:l:d:j:r:m:c:w:k:C:s:vh")) != -1) {
+    switch (opt) {
+      case 'g':
+        config.gateways = strtoul(optarg, NULL, 10);
+        break;
+      case 'n':
+        config.clients = strtoul(optarg, NULL, 10);
+        break;
+      case 'S':
+        config.sleepers = strtoul(optarg, NULL, 10);
+        break;
+      case 't':
+        config.duration = strtod(optarg, NULL) * 1000;
+        break;
+      case 'R':
+        config.ramp = strtoul(optarg, NULL, 10);
+        break;
+      case 'l':
+        config.loss = strtod(optarg, NULL);
+        break;
+      case 'd':
+        config.latency = strtoul(optarg, NULL, 10);
+        break;
+      case 'j':
+        config.jitter = strtoul(optarg, NULL, 10);
+        break;
+      case 'r':
+        config.rate = strtod(optarg, NULL);
+        break;
+      case 'm':
+        config.retries = strtoul(optarg, NULL, 10);
+        break;
+      case 'c':
+        config.channel = strtoul(optarg, NULL, 10);
+        break;
+      case 'w':
+        {
+          char *end;
+
+          config.wifi_drop_period = strtod(optarg, &end) * 1000;
+          if (*end == ':')
+            config.wifi_drop_time = strtoul(end + 1, NULL, 10);
+        }
+        break;
+      case 'k':
+        config.power_off = strtod(optarg, NULL) * 1000;
+        break;
+      case 'C':
+        config.command_period = strtoul(optarg, NULL, 10);
+        break;
+      case 's':
+        config.seed = strtoull(optarg, NULL, 0);
+        break;
+      case 'v':
+        ++config.verbose;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if ((! config.gateways) || (config.gateways > 16) || (! config.clients) || (config.clients > 1000) || (config.rate <= 0) || (config.channel < 1) || (config.channel > 13)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  SimRadio radio(config);
+
+  radio.run();
+  radio.report();
+
+  return 0;
+}
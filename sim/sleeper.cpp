@@ -0,0 +1,16 @@
+#include "SimPrelude.h"
+
+#define CLIENT
+#define DEEP_SLEEP
+
+namespace sleeper {
+#include "../src/main.cpp"
+}
+
+void simSleeperSetup() {
+  sleeper::setup();
+}
+
+void simSleeperLoop() {
+  sleeper::loop();
+}
@@ -7,6 +7,14 @@ static const uint8_t ESPNOW_OK = 0;
 
 static const char ESPNOW_SERVER_AP[] PROGMEM = "ESP-NOW$";
 
+static const uint8_t PROBE_MAGIC[2] = { 'E', 'N' };
+static const uint8_t PROBE_REQUEST = '?';
+static const uint8_t PROBE_REPLY = '!';
+static const uint8_t PROBE_CHANNELS = 13;
+static const uint8_t PROBE_REPEAT = 2; // Probes per channel
+static const uint32_t PROBE_DWELL = 10; // 10 ms. per probe, server answers from its loop()
+static const uint8_t RX_CTRL_OFFSET = 51; // Receive callback data is preceded by action frame header (39) and RxControl (12)
+
 bool EspNowGeneric::begin() {
   if (esp_now_init() != ESPNOW_OK)
     return false;
@@ -29,6 +37,7 @@ bool EspNowGeneric::begin() {
 }
 
 void EspNowGeneric::end() {
+  _async_count = 0;
   clearPeers();
   esp_now_unregister_send_cb();
   esp_now_unregister_recv_cb();
@@ -94,6 +103,8 @@ bool EspNowGeneric::sendBroadcast(const uint8_t *data, uint8_t len) {
 bool EspNowGeneric::sendReliable(const uint8_t *mac, const uint8_t *data, uint8_t len, uint8_t repeat, uint32_t timeout) {
   uint32_t start;
 
+  if (! timeout)
+    timeout = sendTimeout(len);
   do {
     _sended = false;
     _sendError = esp_now_send((uint8_t*)mac, (uint8_t*)data, len) != ESPNOW_OK;
@@ -106,6 +117,64 @@ bool EspNowGeneric::sendReliable(const uint8_t *mac, const uint8_t *data, uint8_
   return ((! _sendError) && _sended);
 }
 
+uint8_t EspNowGeneric::sendAsync(const uint8_t *mac, const uint8_t *data, uint8_t len, uint8_t repeat, uint32_t timeout) {
+  async_send_t *async;
+
+  if ((_async_count >= MAX_ASYNC) || (len > MAX_DATA_LEN))
+    return 0;
+  async = &_async[(_async_head + _async_count) % MAX_ASYNC];
+  memcpy(async->mac, mac, sizeof(async->mac));
+  memcpy(async->data, data, len);
+  async->len = len;
+  if (! ++_async_handle)
+    ++_async_handle;
+  async->handle = _async_handle;
+  async->repeat = repeat;
+  async->timeout = timeout ? timeout : sendTimeout(len);
+  async->state = ASYNC_QUEUED;
+  ++_async_count;
+  EspNowGeneric::poll(); // Not overridden one, it may be the caller
+
+  return async->handle;
+}
+
+void EspNowGeneric::poll() {
+  while (_async_count) {
+    async_send_t *async = &_async[_async_head];
+
+    switch (async->state) {
+      case ASYNC_QUEUED:
+        if ((_async_late != _async_timeouts) && (millis() - _async_timed_out >= ASYNC_LOST))
+          _async_late = _async_timeouts; // Callback was lost, don't swallow next one
+        async->start = millis();
+        async->state = ASYNC_SENDING;
+        _sended = false;
+        if (esp_now_send(async->mac, async->data, async->len) != ESPNOW_OK)
+          async->state = ASYNC_ERROR;
+        break;
+      case ASYNC_SENDING:
+        if (millis() - async->start < async->timeout)
+          return;
+        ++_async_timeouts; // Its callback may still come, it must not be credited to next send
+        _async_timed_out = millis();
+        async->state = ASYNC_ERROR; // No callback in time
+        break;
+      case ASYNC_ERROR:
+        if (async->repeat) {
+          --async->repeat;
+          async->state = ASYNC_QUEUED;
+          break;
+        }
+        // fall through
+      case ASYNC_SENT:
+        _async_head = (_async_head + 1) % MAX_ASYNC;
+        --_async_count;
+        onSendDone(async->handle, async->mac, async->state == ASYNC_SENT);
+        break;
+    }
+  }
+}
+
 bool EspNowServer::begin() {
   char ssid[sizeof(ESPNOW_SERVER_AP)];
 
@@ -131,6 +200,89 @@ bool EspNowServer::begin() {
 void EspNowServer::end() {
   WiFi.softAPdisconnect();
   EspNowGeneric::end();
+  _slot_count = 0;
+}
+
+bool EspNowServer::setChannel(uint8_t channel) {
+  if (channel == _channel)
+    return true;
+  EspNowServer::end(); // Not overridden ones, derived state (peers, reassembly) must survive
+  _channel = channel;
+
+  return EspNowServer::begin();
+}
+
+void EspNowServer::poll() {
+  probe_t probe;
+
+  if ((_async_count < MAX_ASYNC) && _probes.get(probe)) { // One per poll, leave room to application frames
+    espnow_probe_t reply;
+
+    memcpy(reply.magic, PROBE_MAGIC, sizeof(PROBE_MAGIC));
+    reply.magic[2] = PROBE_REPLY;
+    reply.channel = _channel;
+    reply.load = _load;
+    WiFi.softAPmacAddress(reply.mac); // Clients of older versions find it by scan
+    if (usePeer(probe.mac)) {
+      _probe_handles[_probe_next] = sendAsync(probe.mac, (uint8_t*)&reply, sizeof(reply));
+      _probe_next = (_probe_next + 1) % MAX_ASYNC;
+    }
+  }
+  EspNowGeneric::poll();
+}
+
+void EspNowServer::onReceive(const uint8_t *mac, const uint8_t *data, uint8_t len) {
+  if (! isProbe(mac, data, len))
+    EspNowGeneric::onReceive(mac, data, len);
+}
+
+bool EspNowServer::isProbe(const uint8_t *mac, const uint8_t *data, uint8_t len) {
+  if ((len != sizeof(espnow_probe_t)) || memcmp(((espnow_probe_t*)data)->magic, PROBE_MAGIC, sizeof(PROBE_MAGIC)) ||
+    (((espnow_probe_t*)data)->magic[2] != PROBE_REQUEST))
+    return false;
+  {
+    probe_t probe;
+
+    memcpy(probe.mac, mac, sizeof(probe.mac));
+    _probes.put(probe); // Dropped if full, counted as overflow, client repeats its probe
+  }
+
+  return true;
+}
+
+bool EspNowServer::isProbeReply(uint8_t handle) const {
+  if (! handle)
+    return false;
+  for (uint8_t i = 0; i < MAX_ASYNC; ++i) {
+    if (_probe_handles[i] == handle)
+      return true;
+  }
+
+  return false;
+}
+
+bool EspNowServer::usePeer(const uint8_t *mac, esp_now_role role) {
+  uint8_t i, lru = 0;
+
+  for (i = 0; i < _slot_count; ++i) {
+    if (! memcmp(_slots[i].mac, mac, sizeof(_slots[i].mac))) {
+      _slots[i].used = ++_slot_tick;
+      return true;
+    }
+    if (_slots[i].used < _slots[lru].used)
+      lru = i;
+  }
+  if (_slot_count >= MAX_PEER_SLOTS) { // Evict least recently used peer
+    removePeer(_slots[lru].mac);
+    ++_evictions;
+    _slots[lru] = _slots[--_slot_count];
+  }
+  if ((! findPeer(mac)) && (! addPeer(mac, role)))
+    return false;
+  memcpy(_slots[_slot_count].mac, mac, sizeof(_slots[_slot_count].mac));
+  _slots[_slot_count++].used = ++_slot_tick;
+
+  return true;
 }
 
 bool EspNowClient::begin() {
@@ -151,23 +303,179 @@ bool EspNowClient::begin() {
   return false;
 }
 
-int8_t espNowFindServer(uint8_t *mac, int8_t *rssi) {
-  int8_t result;
+bool EspNowClient::setServer(uint8_t channel, const uint8_t *mac) {
+  if (channel != _channel) {
+    if (! wifi_set_channel(channel))
+      return false;
+    _channel = channel;
+  }
+  if (memcmp(mac, _server_mac, sizeof(_server_mac))) {
+    removePeer(_server_mac);
+    memcpy(_server_mac, mac, sizeof(_server_mac));
+  }
+
+  return findPeer(_server_mac) || addPeer(_server_mac);
+}
+
+static espnow_server_t *probeServers;
+static uint8_t probeMax;
+static volatile uint8_t probeCount;
+
+static int8_t rxRssi(const uint8_t *data) { // Of received frame, 0 if unknown
+  int8_t rssi = *(const int8_t*)(data - RX_CTRL_OFFSET); // First field of RxControl
+
+  return (rssi < 0) && (rssi > -100) ? rssi : 0;
+}
+
+static void probeReceive(uint8_t *mac, uint8_t *data, uint8_t len) {
+  const espnow_probe_t *reply = (espnow_probe_t*)data;
+  espnow_server_t *server;
+
+  if ((len != sizeof(espnow_probe_t)) || memcmp(reply->magic, PROBE_MAGIC, sizeof(PROBE_MAGIC)) ||
+    (reply->magic[2] != PROBE_REPLY) || (! reply->channel) || (reply->channel != wifi_get_channel()))
+    return;
+  for (uint8_t i = 0; i < probeCount; ++i) {
+    if (! memcmp(probeServers[i].mac, reply->mac, sizeof(reply->mac))) { // Reply to repeated probe
+      probeServers[i].load = reply->load;
+      if (! probeServers[i].rssi)
+        probeServers[i].rssi = rxRssi(data);
+      return;
+    }
+  }
+  if (probeCount >= probeMax)
+    return;
+  server = &probeServers[probeCount];
+  memcpy(server->mac, reply->mac, sizeof(server->mac));
+  server->channel = reply->channel;
+  server->rssi = rxRssi(data);
+  server->load = reply->load;
+  ++probeCount;
+}
+
+int16_t espNowServerScore(const espnow_server_t *server) {
+  const int8_t RSSI_UNKNOWN = -70; // dB, typical
+  const uint8_t LOAD_PER_DB = 16; // Full load weighs as 16 dB. weaker signal
+
+  return (server->rssi ? server->rssi : RSSI_UNKNOWN) - server->load / LOAD_PER_DB;
+}
+
+uint8_t espNowFindServers(espnow_server_t *servers, uint8_t max, uint8_t channel) {
+  const uint8_t MAX_FOUND = 8;
+
+  espnow_server_t found[MAX_FOUND];
+  uint8_t count = espNowProbeServers(found, MAX_FOUND, channel);
+
+  if (count > 1) { // Lone server needs no ranking
+    uint16_t scanned = 0; // Bit per channel
+
+    for (uint8_t i = 0; i < count; ++i) {
+      if ((! found[i].rssi) && (! (scanned & (1 << found[i].channel)))) { // Scan only if reply had no RSSI
+        espnow_server_t rssi[MAX_FOUND];
+        uint8_t n = espNowScanServers(rssi, MAX_FOUND, found[i].channel);
+
+        scanned |= 1 << found[i].channel;
+        for (uint8_t j = 0; j < n; ++j) {
+          for (uint8_t k = i; k < count; ++k) {
+            if ((! found[k].rssi) && (! memcmp(found[k].mac, rssi[j].mac, sizeof(found[k].mac))))
+              found[k].rssi = rssi[j].rssi;
+          }
+        }
+      }
+    }
+  } else if (! count)
+    count = espNowScanServers(found, MAX_FOUND);
+  for (uint8_t i = 1; i < count; ++i) { // Insertion sort by score, best first
+    espnow_server_t server = found[i];
+    int16_t score = espNowServerScore(&server);
+    uint8_t j = i;
+
+    while (j && (espNowServerScore(&found[j - 1]) < score)) {
+      found[j] = found[j - 1];
+      --j;
+    }
+    found[j] = server;
+  }
+  if (count > max)
+    count = max;
+  memcpy(servers, found, count * sizeof(espnow_server_t));
+
+  return count;
+}
+
+int8_t espNowFindServer(uint8_t *mac, int8_t *rssi, uint8_t channel) {
+  espnow_server_t server;
+
+  if (! espNowFindServers(&server, 1, channel))
+    return 0;
+  if (mac)
+    memcpy(mac, server.mac, sizeof(server.mac));
+  if (rssi)
+    *rssi = server.rssi;
+
+  return server.channel;
+}
+
+uint8_t espNowProbeServers(espnow_server_t *servers, uint8_t max, uint8_t channel) {
+  espnow_probe_t probe;
+  uint8_t broadcast[6];
+
+  memset(&probe, 0, sizeof(probe));
+  memcpy(probe.magic, PROBE_MAGIC, sizeof(PROBE_MAGIC));
+  probe.magic[2] = PROBE_REQUEST;
+  memset(broadcast, 0xFF, sizeof(broadcast));
+  if ((channel < 1) || (channel > PROBE_CHANNELS))
+    channel = 0;
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.disconnect();
+  if (esp_now_init() != ESPNOW_OK)
+    return 0;
+  probeServers = servers;
+  probeMax = max;
+  probeCount = 0;
+  if ((esp_now_set_self_role(ESP_NOW_ROLE_COMBO) == ESPNOW_OK) && (esp_now_register_recv_cb(&probeReceive) == ESPNOW_OK)) {
+    // Last known channel first and alone if anybody answers there, otherwise all channels
+    for (uint8_t i = 0; i <= PROBE_CHANNELS; ++i) {
+      uint8_t ch = i ? i : channel;
+      uint8_t before = probeCount;
+
+      if ((! ch) || (i && (ch == channel)) || (! wifi_set_channel(ch)))
+        continue;
+      for (uint8_t repeat = 0; (repeat < PROBE_REPEAT) && (probeCount == before); ++repeat) { // Other answers come within dwell
+        uint32_t start = millis();
+
+        esp_now_send(broadcast, (uint8_t*)&probe, sizeof(probe));
+        while (millis() - start < PROBE_DWELL) {
+          delay(1);
+        }
+      }
+      if ((! i) && probeCount)
+        break;
+    }
+    esp_now_unregister_recv_cb();
+  }
+  esp_now_deinit();
+
+  return probeCount;
+}
+
+uint8_t espNowScanServers(espnow_server_t *servers, uint8_t max, uint8_t channel) {
+  int8_t count;
+  uint8_t result = 0;
   char ssid[sizeof(ESPNOW_SERVER_AP)];
 
   WiFi.persistent(false);
   WiFi.mode(WIFI_STA);
   WiFi.disconnect();
   strcpy_P(ssid, ESPNOW_SERVER_AP);
-  result = WiFi.scanNetworks(false, true, 0, (uint8_t*)ssid);
-  if (result == 1) {
-    result = WiFi.channel(0);
-    if (mac)
-      memcpy(mac, WiFi.BSSID(0), 6);
-    if (rssi)
-      *rssi = WiFi.RSSI(0);
-  } else
-    result = 0;
+  count = WiFi.scanNetworks(false, true, channel, (uint8_t*)ssid);
+  for (int8_t i = 0; (i < count) && (result < max); ++i) {
+    memcpy(servers[result].mac, WiFi.BSSID(i), sizeof(servers[result].mac));
+    servers[result].channel = WiFi.channel(i);
+    servers[result].rssi = WiFi.RSSI(i);
+    servers[result].load = ESPNOW_LOAD_UNKNOWN;
+    ++result;
+  }
   WiFi.scanDelete();
 
   return result;
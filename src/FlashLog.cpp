@@ -0,0 +1,146 @@
+#include <string.h>
+#include "FlashLog.h"
+
+uint16_t FlashLog::crc16(const void *data, uint16_t len, uint16_t crc) {
+  const uint8_t *bytes = (const uint8_t*)data;
+
+  while (len--) {
+    crc ^= (uint16_t)*bytes++ << 8;
+    for (uint8_t i = 0; i < 8; ++i) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+
+  return crc;
+}
+
+static uint16_t headerCrc(const FlashLog::header_t *header, const uint8_t *data) {
+  uint16_t crc = FlashLog::crc16(&header->len, sizeof(header->len));
+
+  crc = FlashLog::crc16(&header->seq, sizeof(header->seq), crc);
+
+  return FlashLog::crc16(data, header->len, crc);
+}
+
+bool FlashLog::begin() {
+  const uint8_t SCAN_SLOTS = 8; // Read at once while scanning
+
+  uint8_t buf[SCAN_SLOTS * MAX_SLOT];
+  header_t header;
+  bool found = false;
+
+  if ((_slot <= sizeof(header_t)) || (_slot > MAX_SLOT) || (! _storage->begin()))
+    return false;
+  _capacity = _storage->size() / _slot;
+  if (_capacity < 2)
+    return false;
+  --_capacity; // Slot 0 is read position
+  _head = 0;
+  if (readSlot(0, &header, NULL) && (header.magic == MAGIC_HEAD))
+    _head = header.seq;
+  _tail = _head;
+  for (uint32_t slot = 1; slot <= _capacity; slot += SCAN_SLOTS) {
+    uint8_t slots = _capacity - slot + 1 < SCAN_SLOTS ? _capacity - slot + 1 : SCAN_SLOTS;
+
+    if (! _storage->read(slot * _slot, buf, slots * _slot))
+      return false;
+    for (uint8_t i = 0; i < slots; ++i) {
+      const uint8_t *record = &buf[i * _slot];
+
+      memcpy(&header, record, sizeof(header));
+      if ((header.magic == MAGIC_RECORD) && (header.len <= _slot - sizeof(header_t)) &&
+        ((slot + i - 1) == header.seq % _capacity) && (header.crc == headerCrc(&header, &record[sizeof(header_t)]))) {
+        if ((! found) || (header.seq - _tail < 0x80000000)) // Newest by serial number arithmetic
+          _tail = header.seq;
+        found = true;
+      }
+    }
+  }
+  if (found)
+    ++_tail;
+  if (_tail - _head >= 0x80000000) // Read position is newer than every record
+    _tail = _head;
+  if (_tail - _head > _capacity)
+    _head = _tail - _capacity;
+  _committed = _head;
+  _dirty = false;
+
+  return true;
+}
+
+bool FlashLog::readSlot(uint32_t slot, header_t *header, uint8_t *data) {
+  uint8_t buf[MAX_SLOT];
+
+  if (! _storage->read(slot * _slot, buf, _slot))
+    return false;
+  memcpy(header, buf, sizeof(header_t));
+  if ((header->len > _slot - sizeof(header_t)) || (header->crc != headerCrc(header, &buf[sizeof(header_t)])))
+    return false;
+  if (data)
+    memcpy(data, &buf[sizeof(header_t)], header->len);
+
+  return true;
+}
+
+bool FlashLog::writeSlot(uint32_t slot, uint8_t magic, uint32_t seq, const void *data, uint8_t len) {
+  uint8_t buf[MAX_SLOT];
+  header_t *header = (header_t*)buf;
+
+  header->magic = magic;
+  header->len = len;
+  header->seq = seq;
+  if (len)
+    memcpy(&buf[sizeof(header_t)], data, len);
+  memset(&buf[sizeof(header_t) + len], 0, _slot - sizeof(header_t) - len);
+  header->crc = headerCrc(header, &buf[sizeof(header_t)]);
+
+  return _storage->write(slot * _slot, buf, _slot);
+}
+
+bool FlashLog::append(const void *data, uint8_t len) {
+  if ((! _capacity) || (! len) || (len > _slot - sizeof(header_t)))
+    return false;
+  if (! writeSlot(1 + _tail % _capacity, MAGIC_RECORD, _tail, data, len))
+    return false;
+  if (++_tail - _head > _capacity) { // Oldest one is overwritten
+    ++_head;
+    ++_lost;
+  }
+  _dirty = true;
+
+  return true;
+}
+
+uint8_t FlashLog::peek(void *data) {
+  while (_head != _tail) {
+    header_t header;
+
+    if (readSlot(1 + _head % _capacity, &header, (uint8_t*)data) && (header.magic == MAGIC_RECORD) && (header.seq == _head))
+      return header.len;
+    ++_head; // Torn or missing record
+    ++_lost;
+  }
+
+  return 0;
+}
+
+void FlashLog::pop() {
+  if (_head != _tail)
+    ++_head;
+}
+
+bool FlashLog::commit() {
+  if (_head != _committed) {
+    if (! writeSlot(0, MAGIC_HEAD, _head, NULL, 0))
+      return false;
+    _committed = _head;
+    _dirty = true;
+  }
+  if (_dirty) {
+    if (! _storage->flush())
+      return false;
+    _dirty = false;
+  }
+
+  return true;
+}
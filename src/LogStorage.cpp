@@ -0,0 +1,108 @@
+#include <string.h>
+#include "LogStorage.h"
+
+static const uint16_t FILL_CHUNK = 256;
+
+#ifdef ARDUINO
+bool FileLogStorage::begin() {
+  if (! LittleFS.begin())
+    return false;
+  _file = LittleFS.open(_path, LittleFS.exists(_path) ? "r+" : "w+");
+  if (! _file)
+    return false;
+  if (_file.size() < _size) { // New or truncated, fill the rest once so later writes don't grow the file
+    uint8_t zeros[FILL_CHUNK];
+    uint32_t offset = _file.size();
+
+    memset(zeros, 0, sizeof(zeros));
+    _file.seek(offset, SeekSet);
+    while (offset < _size) {
+      uint16_t len = _size - offset < sizeof(zeros) ? _size - offset : sizeof(zeros);
+
+      if (_file.write(zeros, len) != len) {
+        _file.close();
+        return false;
+      }
+      offset += len;
+    }
+    _file.flush();
+  }
+
+  return true;
+}
+
+void FileLogStorage::end() {
+  if (_file)
+    _file.close();
+}
+
+bool FileLogStorage::read(uint32_t offset, void *data, uint16_t len) {
+  return _file && (offset + len <= _size) && _file.seek(offset, SeekSet) && (_file.read((uint8_t*)data, len) == len);
+}
+
+bool FileLogStorage::write(uint32_t offset, const void *data, uint16_t len) {
+  return _file && (offset + len <= _size) && _file.seek(offset, SeekSet) && (_file.write((const uint8_t*)data, len) == len);
+}
+
+bool FileLogStorage::flush() {
+  if (! _file)
+    return false;
+  _file.flush();
+
+  return true;
+}
+#else
+bool FileLogStorage::begin() {
+  const char *path = *_path == '/' ? _path + 1 : _path;
+  long length;
+  uint32_t offset;
+
+  end();
+  _file = fopen(path, "r+b");
+  if (! _file)
+    _file = fopen(path, "w+b");
+  if (! _file)
+    return false;
+  if (fseek(_file, 0, SEEK_END) || ((length = ftell(_file)) < 0)) {
+    end();
+    return false;
+  }
+  offset = length;
+  if (offset < _size) {
+    uint8_t zeros[FILL_CHUNK];
+
+    memset(zeros, 0, sizeof(zeros));
+    while (offset < _size) {
+      uint16_t len = _size - offset < sizeof(zeros) ? _size - offset : sizeof(zeros);
+
+      if (fwrite(zeros, 1, len, _file) != len) {
+        end();
+        return false;
+      }
+      offset += len;
+    }
+    fflush(_file);
+  }
+
+  return true;
+}
+
+void FileLogStorage::end() {
+  if (_file) {
+    fclose(_file);
+    _file = NULL;
+  }
+}
+
+bool FileLogStorage::read(uint32_t offset, void *data, uint16_t len) {
+  return _file && (offset + len <= _size) && (! fseek(_file, offset, SEEK_SET)) && (fread(data, 1, len, _file) == len);
+}
+
+bool FileLogStorage::write(uint32_t offset, const void *data, uint16_t len) {
+  return _file && (offset + len <= _size) && (! fseek(_file, offset, SEEK_SET)) && (fwrite(data, 1, len, _file) == len);
+}
+
+bool FileLogStorage::flush() {
+  return _file && (! fflush(_file));
+}
+#endif
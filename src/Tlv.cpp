@@ -0,0 +1,82 @@
+#include <string.h>
+#include "Tlv.h"
+
+uint8_t TlvWriter::varintSize(uint32_t value) {
+  uint8_t result = 1;
+
+  while (value >= 0x80) {
+    value >>= 7;
+    ++result;
+  }
+
+  return result;
+}
+
+bool TlvWriter::putVarint(uint8_t key, tlv_wire_t wire, uint32_t value) {
+  if ((key > TLV_MAX_KEY) || (_len + 1 + varintSize(value) > _size))
+    return false;
+  _buf[_len++] = (key << 3) | wire;
+  while (value >= 0x80) {
+    _buf[_len++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  _buf[_len++] = value;
+
+  return true;
+}
+
+bool TlvWriter::putBytes(uint8_t key, const uint8_t *data, uint8_t len) {
+  if ((key > TLV_MAX_KEY) || (_len + 1 + varintSize(len) + len > _size))
+    return false;
+  putVarint(key, TLV_BYTES, len);
+  memcpy(&_buf[_len], data, len);
+  _len += len;
+
+  return true;
+}
+
+bool TlvView::getVarint(uint32_t &value) {
+  uint8_t shift = 0;
+
+  value = 0;
+  while (_pos < _len) {
+    uint8_t b = _data[_pos++];
+
+    value |= (uint32_t)(b & 0x7F) << shift;
+    if (! (b & 0x80))
+      return true;
+    shift += 7;
+    if (shift > 28) // More than 5 bytes
+      break;
+  }
+  _error = true;
+
+  return false;
+}
+
+bool TlvView::next(tlv_item_t &item) {
+  uint8_t tag;
+
+  if (_error || (_pos >= _len))
+    return false;
+  tag = _data[_pos++];
+  item.key = tag >> 3;
+  item.wire = (tlv_wire_t)(tag & 0x07);
+  item.data = NULL;
+  if (item.wire > TLV_BYTES) {
+    _error = true;
+    return false;
+  }
+  if (! getVarint(item.value))
+    return false;
+  if (item.wire == TLV_BYTES) {
+    if (item.value > (uint32_t)(_len - _pos)) {
+      _error = true;
+      return false;
+    }
+    item.data = &_data[_pos];
+    _pos += item.value;
+  }
+
+  return true;
+}
@@ -1,5 +1,8 @@
+#ifndef CLIENT
 #define SERVER
+#endif
 #define ASYNC_MQTT
+//#define DEEP_SLEEP // Client sends one reading per wake up and sleeps
 
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
@@ -11,6 +14,15 @@
 #endif
 #endif
 #include "EspNowHelper.h"
+#include "Tlv.h"
+#include "Trace.h"
+#include "Histogram.h"
+#ifdef SERVER
+#include "SpscRing.h"
+#include "PeerTable.h"
+#include "PublishQueue.h"
+#include "FlashLog.h"
+#endif
 #include "Leds.h"
 
 const uint8_t LED_PIN = 2;
@@ -22,17 +34,30 @@ static const char WIFI_PSWD[] PROGMEM = "******";
 
 static const char MQTT_SERVER[] = "******";
 static const uint16_t MQTT_PORT = 1883;
-static const char MQTT_CLIENT[] = "MQTT-NOW";
+static const char MQTT_CLIENT[] = "MQTT-NOW-"; // Followed by chip ID, so gateways sharing broker don't kick each other
 static const char MQTT_PREFIX[] PROGMEM = "/MQTT-NOW";
 static const uint8_t MQTT_QOS = 0;
 static const bool MQTT_RETAIN = false;
 
 static const char MQTT_UPTIME_TOPIC[] PROGMEM = "/uptime";
+static const char MQTT_TEMPERATURE_TOPIC[] PROGMEM = "/temperature";
+static const char MQTT_HUMIDITY_TOPIC[] PROGMEM = "/humidity";
+static const char MQTT_PRESSURE_TOPIC[] PROGMEM = "/pressure";
+static const char MQTT_VOLTAGE_TOPIC[] PROGMEM = "/voltage";
+static const char MQTT_DIAGNOSTICS_TOPIC[] PROGMEM = "/diagnostics";
+static const char MQTT_COMMAND_TOPIC[] PROGMEM = "/command/"; // Followed by chip ID as in sensor topics
+static const char MQTT_SYS_TOPIC[] PROGMEM = "/$SYS/"; // Followed by chip ID of gateway and metric name
+
+static const char * const MQTT_TOPICS[] PROGMEM = { NULL, MQTT_UPTIME_TOPIC, MQTT_TEMPERATURE_TOPIC,
+  MQTT_HUMIDITY_TOPIC, MQTT_PRESSURE_TOPIC, MQTT_VOLTAGE_TOPIC, MQTT_DIAGNOSTICS_TOPIC }; // By sensor_key_t
 #endif
 
 static const uint8_t ESPNOW_MAGIC = 0xA5;
 
-enum espnow_type_t : uint8_t { ESPNOW_ACK, ESPNOW_DATA };
+enum espnow_type_t : uint8_t { ESPNOW_ACK, ESPNOW_DATA, ESPNOW_ACKS, ESPNOW_BATCH, ESPNOW_TLV, ESPNOW_FRAG };
+
+enum sensor_key_t : uint8_t { SENSOR_ID, SENSOR_UPTIME, SENSOR_TEMPERATURE, SENSOR_HUMIDITY, SENSOR_PRESSURE, SENSOR_VOLTAGE,
+  SENSOR_DIAGNOSTICS, SENSOR_COMMAND }; // TLV and message keys, SENSOR_COMMAND echoes id of received command
 
 struct __packed espnow_header_t {
   uint8_t magic; // Must be == ESPNOW_MAGIC (0xA5)
@@ -50,32 +75,177 @@ struct __packed espnow_data_t {
   payload_t payload;
 };
 
+static const uint8_t ESPNOW_MAX_RECORDS = (250 - sizeof(espnow_header_t)) / sizeof(payload_t);
+
+struct __packed espnow_batch_t { // Count of records is derived from length
+  espnow_header_t header;
+  payload_t records[ESPNOW_MAX_RECORDS];
+};
+
+struct __packed espnow_tlv_t { // SENSOR_ID item (chip ID by default) applies to following items
+  espnow_header_t header;
+  uint8_t data[250 - sizeof(espnow_header_t)];
+};
+
+struct __packed espnow_frag_t { // Fragment of message, each is sent and acked as separate frame
+  espnow_header_t header;
+  uint8_t msg; // Message ID, per sender
+  uint8_t index; // Of fragment, all but last one carry full data
+  uint8_t count; // Of fragments in message
+  sensor_key_t key; // Of whole message
+  uint8_t data[250 - sizeof(espnow_header_t) - 4];
+};
+
+static const uint8_t ESPNOW_MAX_FRAGMENTS = 16;
+static const uint16_t ESPNOW_MAX_MESSAGE = ESPNOW_MAX_FRAGMENTS * sizeof(espnow_frag_t::data);
+
+struct __packed espnow_ack_t {
+  uint8_t id[3]; // 3 lower bytes of client MAC
+  uint16_t num;
+};
+
+static const uint8_t ESPNOW_MAX_ACKS = (250 - sizeof(espnow_header_t)) / sizeof(espnow_ack_t);
+
+struct __packed espnow_acks_t { // Broadcasted, count of acks is derived from length
+  espnow_header_t header; // num is not used
+  espnow_ack_t acks[ESPNOW_MAX_ACKS];
+};
+
+static const uint8_t ESPNOW_MAX_COMMAND = 64;
+
+struct __packed espnow_command_t { // ESPNOW_ACK with downlink command for the acked client
+  espnow_header_t header;
+  uint8_t id; // Repeated command (same id) is ignored by client
+  uint8_t data[ESPNOW_MAX_COMMAND]; // Length is derived from frame length
+};
+
 #ifdef SERVER
 class EspNowServerPlus : public EspNowServer {
 public:
-  EspNowServerPlus() : EspNowServer(), _peer_count(0) {}
+  EspNowServerPlus() : EspNowServer(), _ack_count(0), _ack_timing(0) {
+    memset(_messages, 0, sizeof(_messages));
+    memset(_ack_timings, 0, sizeof(_ack_timings));
+    memset(_mailbox, 0, sizeof(_mailbox));
+  }
 
   void end();
 
+  uint32_t overflows() const {
+    return _frames.overflows();
+  }
+
+  bool postCommand(uint32_t id, const uint8_t *data, uint8_t len); // false if peer is unknown or mailbox is full
+
 protected:
   struct __packed peer_t {
     uint8_t mac[6];
-    uint16_t num;
-    payload_t payload;
+    uint16_t num; // Highest received
+    uint64_t window; // Bit N is set if (num - N) was received
+    uint32_t received;
+    uint32_t duplicates;
+    uint32_t reordered; // Received after a newer one
+    uint32_t lost; // Left the window unreceived
+    char topic_id[8]; // Chip ID in MQTT topic, rendered once
     bool acknowledged;
+    uint16_t ack_num;
+    uint16_t ack_time; // Low 16 bits of millis() when ACK was queued
+    uint8_t command_seq; // Of last command posted to it, so a new one never repeats the id client saw last
   };
 
-  static const uint8_t MAX_PEERS = 10;
+  struct __packed frame_t { // One per record
+    uint8_t mac[6];
+    uint16_t num;
+    uint8_t index; // Of record in batch
+    uint32_t id;
+    sensor_key_t key;
+    tlv_wire_t wire;
+    uint32_t value;
+    uint32_t time; // micros() in onReceive()
+  };
+
+  struct __packed ack_timing_t { // ACK on air, for its latency
+    uint8_t handle; // 0 means free
+    uint32_t time; // Of oldest frame acked
+  };
+
+  static const uint16_t PEER_SLOTS = 256; // Must be power of 2, up to 3/4 of it are used
+  static const uint8_t MAX_RECORDS = 64; // Per frame, not less than ESPNOW_MAX_RECORDS
+  static const uint8_t MAX_FRAMES = 128; // Must be power of 2 and not less than MAX_RECORDS
+  static const uint16_t ACK_HOLDOFF = 5; // 5 ms. before duplicate is acked again
+  static const int16_t MAX_GAP = 1024; // Larger jump of num means restarted client
+
+  enum message_state_t : uint8_t { MESSAGE_FREE, MESSAGE_BUSY, MESSAGE_DONE, MESSAGE_HELD }; // HELD waits for MQTT
+
+  struct __packed message_t { // Reassembly of fragmented message
+    uint8_t mac[6];
+    uint8_t msg;
+    uint8_t count;
+    uint16_t received; // Bitmask of fragments
+    uint16_t offset; // In _arena
+    uint16_t length; // Valid when done
+    uint32_t time; // Of first fragment
+    sensor_key_t key; // Valid when held
+    uint32_t done; // micros() of last fragment, valid when held
+    volatile message_state_t state; // BUSY is owned by onReceive(), DONE and HELD by loop()
+  };
+
+  static const uint8_t MAX_MESSAGES = 4;
+  static const uint16_t ARENA_SIZE = 4096; // Memory cap of all messages in reassembly
+  static const uint32_t REASSEMBLY_TIMEOUT = 5000; // 5 sec.
+  static const uint8_t ERR_MESSAGE = 0xFF;
+  static const uint8_t DUP_MESSAGE = 0xFE; // Fragment was received already
+  static const uint16_t ERR_OFFSET = 0xFFFF;
+
+  struct __packed mailbox_t { // Downlink command, rides on every ACK to its peer until echoed back
+    uint32_t id; // Chip ID of peer
+    uint32_t time; // Of posting
+    uint8_t seq; // Command id on air, 0 means free slot
+    uint8_t len;
+    uint8_t data[ESPNOW_MAX_COMMAND];
+  };
+
+  static const uint8_t MAX_MAILBOX = 8; // Commands of all peers, one per peer (latest wins)
+  static const uint32_t COMMAND_TTL = 600000; // 10 min., undelivered command is dropped
+  static const uint8_t MAX_ACK_TIMINGS = 8;
 
   void onReceive(const uint8_t *mac, const uint8_t *data, uint8_t len);
+  void onSendDone(uint8_t handle, const uint8_t *mac, bool success);
 
   bool isDataPacket(const uint8_t *data, uint8_t len);
-  bool sendAck(const uint8_t *mac);
+  bool isBatchPacket(const uint8_t *data, uint8_t len);
+  bool isTlvPacket(const uint8_t *data, uint8_t len);
+  uint8_t unpackTlv(const uint8_t *mac, const uint8_t *data, uint8_t len);
+  bool isFragPacket(const uint8_t *data, uint8_t len);
+  // Index of done message, MAX_MESSAGES if incomplete, DUP_MESSAGE if fragment is repeated
+  uint8_t reassemble(const uint8_t *mac, const espnow_frag_t *frag, uint8_t len);
+  uint16_t allocMessage(uint16_t size); // Offset in _arena or ERR_OFFSET
+  void freeMessage(uint8_t index) {
+    _messages[index].state = MESSAGE_FREE;
+  }
+  bool sendAck(const uint8_t *mac, uint16_t num, uint32_t time); // Carries the oldest command for peer, time of acked frame
+  bool queueAck(peer_t *peer, uint16_t num, uint32_t time);
+  bool flushAcks();
+  void timeAck(uint8_t handle, uint32_t time); // Remember time of frame acked by sendAsync() handle
+  mailbox_t *commandFor(uint32_t id); // Pending one or NULL
+  void confirmCommand(uint32_t id, uint8_t seq); // Peer echoed seq back
+  void expireCommands();
 
   peer_t *peerByMac(const uint8_t *mac);
-
-  peer_t _peers[MAX_PEERS];
-  uint8_t _peer_count;
+  peer_t *peerByFrame(const frame_t *frame, bool *fresh);
+  bool isSeen(const frame_t *frame); // Frame is known duplicate
+
+  PeerTable<peer_t, PEER_SLOTS> _peers;
+  SpscRing<frame_t, MAX_FRAMES> _frames;
+  frame_t _batch[MAX_RECORDS]; // Used by onReceive() only
+  message_t _messages[MAX_MESSAGES];
+  uint8_t _arena[ARENA_SIZE]; // Preallocated reassembly buffers
+  espnow_acks_t _acks;
+  peer_t *_ack_peers[ESPNOW_MAX_ACKS];
+  uint32_t _ack_times[ESPNOW_MAX_ACKS];
+  uint8_t _ack_count;
+  ack_timing_t _ack_timings[MAX_ACK_TIMINGS];
+  uint8_t _ack_timing; // Next to reuse
+  mailbox_t _mailbox[MAX_MAILBOX];
 
   friend void loop();
 };
@@ -83,15 +253,100 @@ protected:
 #else
 class EspNowClientPlus : public EspNowClient {
 public:
-  EspNowClientPlus(uint8_t channel, const uint8_t *mac) : EspNowClient(channel, mac), _num(0) {}
+  EspNowClientPlus(uint8_t channel, const uint8_t *mac) : EspNowClient(channel, mac), _num(0), _base(1),
+    _writer(_batch.data, sizeof(_batch.data)), _batch_count(0), _message(NULL), _message_id(0), _oks(0), _fails(0),
+    _command_id(0), _command_len(0), _command_echo(false) {}
+
+  bool begin();
+  void poll();
+
+  uint16_t num() const {
+    return _num;
+  }
+  void setNum(uint16_t num) { // Continue numbering (after deep sleep), only before first send
+    _num = num;
+    _base = num + 1;
+  }
+  bool sendData(); // Only adds reading to batch, false if batch and window are full
+  bool flush() { // Send batch (or pending command echo alone) now, false if window is full
+    if ((! _batch_count) && (! _command_echo))
+      return true;
+    if (! _batch_count)
+      startBatch();
+    return sendBatch();
+  }
+  bool idle() const { // Everything is sent and acked or failed, received command is confirmed
+    return (_base == (uint16_t)(_num + 1)) && (! _batch_count) && (! _message) && (! _command_echo);
+  }
+  void setCommand(uint8_t id, bool echo) { // Restore last received command (after deep sleep)
+    _command_id = id;
+    _command_echo = echo;
+  }
+
+  bool sendMessage(sensor_key_t key, const uint8_t *data, uint16_t len); // Caller keeps data until messagePending() is false
+  bool messagePending() const {
+    return _message != NULL;
+  }
 
 protected:
+  enum slot_state_t : uint8_t { SLOT_WAIT, SLOT_ACKED, SLOT_FAILED };
+
+  struct __packed slot_t {
+    union {
+      espnow_header_t header;
+      espnow_tlv_t tlv;
+      espnow_frag_t frag;
+    } data;
+    uint8_t len;
+    volatile slot_state_t state;
+    uint8_t handle; // Of asynchronous send, 0 if not on air
+    uint8_t repeat;
+    uint8_t rounds; // Of backoff
+    uint16_t wait; // Before next attempt
+    uint32_t start; // ACK waiting start
+    uint32_t sent; // micros() of first attempt
+    uint32_t tx; // micros() of current attempt
+  };
+
+  static const uint8_t WINDOW = 8; // Readings in flight, 1 means stop-and-wait
+  static_assert((WINDOW & (WINDOW - 1)) == 0, "WINDOW must be a power of two"); // num % WINDOW survives num wraparound
+  static const uint8_t BATCH_RECORDS = 6; // Send batch when it has so many records
+  static const uint32_t BATCH_AGE = 30000; // 30 sec., or its first record is so old
+  static const uint8_t REPEAT = 5;
+  static const uint32_t ACK_TIMEOUT = 8; // 8 ms., longer than gateway round trip or window is flooded with repeats
+  static const uint16_t BACKOFF = 250; // 250 ms., pause after all repeats are unacked (gateway is busy), doubled every round
+  static const uint8_t BACKOFF_ROUNDS = 4;
+
   void onReceive(const uint8_t *mac, const uint8_t *data, uint8_t len);
+  void onSendDone(uint8_t handle, const uint8_t *mac, bool success);
 
   bool isAckPacket(const uint8_t *data, uint8_t len);
-  bool sendData();
-
-  uint16_t _num;
+  bool isAcksPacket(const uint8_t *data, uint8_t len);
+  void ack(uint16_t num);
+  void startBatch();
+  bool sendBatch(); // Moves batch to window, false if window is full
+  bool sendFragment(); // Moves next fragment of message to window, false if window is full
+  slot_t *addSlot(espnow_type_t type, uint8_t len); // NULL if window is full
+
+  uint16_t _num; // Last queued
+  uint16_t _base; // Oldest unfinished
+  uint8_t _id[3];
+  slot_t _window[WINDOW];
+  espnow_tlv_t _batch;
+  TlvWriter _writer; // Over _batch.data
+  uint8_t _batch_count;
+  uint32_t _batch_start;
+  const uint8_t *_message;
+  uint16_t _message_len;
+  sensor_key_t _message_key;
+  uint8_t _message_id;
+  uint8_t _fragment; // Next to send
+  uint8_t _oks;
+  uint8_t _fails;
+  uint8_t _command_id; // Last received
+  volatile uint8_t _command_len; // Of command not yet handled by loop()
+  volatile bool _command_echo; // Confirm _command_id to gateway in next batch
+  char _command[ESPNOW_MAX_COMMAND + 1];
 
   friend void loop();
 };
@@ -100,6 +355,15 @@ protected:
 Led *led = NULL;
 EspNowGeneric *esp_now = NULL;
 #ifdef SERVER
+static Log2Histogram drainLatency; // us. from onReceive() to loop()
+static Log2Histogram ackLatency; // us. from onReceive() to ACK on air
+static Log2Histogram publishLatency; // us. from onReceive() to mqttPublish() done
+#else
+static Log2Histogram txLatency; // us. from sendAsync() to frame on air
+static Log2Histogram ackLatency; // us. from first attempt to ACK
+#endif
+static const uint32_t LATENCY_PERIOD = 60000; // 1 min.
+#ifdef SERVER
 WiFiEventHandler wifiConnectHandler;
 WiFiEventHandler wifiDisconnectHandler;
 #ifdef ASYNC_MQTT
@@ -107,23 +371,115 @@ AsyncMqttClient *mqtt = NULL;
 #else
 PubSubClient *mqtt;
 #endif
+char mqttClientId[sizeof(MQTT_CLIENT) + 8];
 
 volatile uint32_t wifiLastConnecting = 0;
 volatile uint32_t mqttLastConnecting = 0;
+
+static const uint8_t MQTT_MAX_TOPIC = 12; // Longest of MQTT_TOPICS or "/sensorNNN"
+
+static char mqttTopic[sizeof(MQTT_PREFIX) - 1 + MQTT_MAX_TOPIC + 1 + 8 + 1]; // Reused by every publish
+static char mqttValue[12];
+
+struct __packed publish_t {
+  uint32_t id; // id and key are coalescing key when queue is near full
+  sensor_key_t key;
+  tlv_wire_t wire;
+  uint32_t value;
+  char topic_id[8];
+  uint32_t time; // micros() in onReceive(), not logged
+};
+
+static const uint8_t LOG_RECORD = offsetof(publish_t, time); // Format of log predates time
+
+static const uint8_t MQTT_QUEUE_SIZE = 64;
+static const uint8_t MQTT_QUEUE_HIGH = 48; // Stop acking new frames, so clients back off
+static const uint8_t MQTT_QUEUE_LOW = 16; // Resume acking
+
+static PublishQueue<publish_t, sizeof(uint32_t) + sizeof(sensor_key_t), MQTT_QUEUE_SIZE> mqttQueue(QUEUE_DROP_OLDEST,
+  MQTT_QUEUE_HIGH, MQTT_QUEUE_LOW);
+static uint32_t mqttThrottled = 0; // Batches left unacked while queue was throttled
+
+struct metrics_t { // Gateway counters, published periodically under MQTT_SYS_TOPIC
+  volatile uint32_t frames; // Received by ESP-NOW callback
+  volatile uint32_t malformed;
+  uint32_t duplicates;
+  uint32_t reordered; // Received after a newer one of the same peer
+  uint32_t lost; // Left replay window of its peer unreceived
+  uint32_t acks_ok;
+  uint32_t acks_failed;
+  uint32_t publishes_failed;
+  uint32_t loop_max; // us. since last report
+  uint32_t loop_sum; // us. since last report
+  uint32_t loops;
+};
+
+static const uint32_t METRICS_PERIOD = 60000; // 1 min.
+
+static metrics_t metrics;
+
+static const char LOG_FILE[] = "/readings.log";
+static const uint32_t LOG_SIZE = 262144; // 256 KB. of flash, over 10000 readings
+static const uint8_t LOG_DRAIN_BATCH = 16; // Logged readings published at once
+static const uint32_t LOG_DRAIN_PERIOD = 20; // 20 ms., leaves the broker link to live readings too
+static const uint32_t LOG_FLUSH_PERIOD = 1000; // 1 sec.
+
+static FileLogStorage logStorage(LOG_FILE, LOG_SIZE);
+static FlashLog readingsLog(&logStorage, sizeof(FlashLog::header_t) + LOG_RECORD);
+static bool logReady = false;
+static bool logDrain = false; // Set once MQTT is connected
+
+struct __packed command_t { // From MQTT callback to loop()
+  uint32_t id; // Chip ID of addressed client
+  uint8_t len;
+  uint8_t data[ESPNOW_MAX_COMMAND];
+};
+
+static SpscRing<command_t, 4> mqttCommands;
 #endif
 
-static String macToString(const uint8_t mac[]);
+static char hexDigit(uint8_t value) {
+  return value < 10 ? '0' + value : 'A' - 10 + value;
+}
+
+#ifdef SERVER
+static uint32_t macToId(const uint8_t mac[]) { // Same as ESP.getChipId() of that node
+  return ((uint32_t)mac[3] << 16) | (mac[4] << 8) | mac[5];
+}
 
+static void idToTopic(char *topic, uint32_t id) { // 8 hex digits, not terminated
+  for (int8_t i = 7; i >= 0; --i) {
+    topic[i] = hexDigit(id & 0x0F);
+    id >>= 4;
+  }
+}
+#endif
+
+static const char *macToString(const uint8_t mac[]);
+
+enum trace_event_t : uint8_t { EVENT_RECEIVED, EVENT_MALFORMED_TLV, EVENT_RX_OVERFLOW, EVENT_REASSEMBLY_TIMEOUT,
+  EVENT_REASSEMBLY_FULL, EVENT_WRONG_FRAGMENT, EVENT_WRONG_NUM };
+
+#if TRACE_LEVEL > TRACE_NONE
+static TraceRing<32> trace; // Filled by ESP-NOW callbacks, printed by loop()
+
+// Reads no more than TRACE_DATA leading bytes, so it works on traced frames too
 static void dumpPacket(const uint8_t *data, uint8_t len) {
   bool error = true;
 
-  if (len == sizeof(espnow_header_t)) {
-    if ((((espnow_header_t*)data)->magic == ESPNOW_MAGIC) && (((espnow_header_t*)data)->type == ESPNOW_ACK)) {
-      Serial.print(F("ESP-NOW ACK packet (#"));
-      Serial.print(((espnow_header_t*)data)->num);
-      Serial.println(')');
-      error = false;
+  if ((len >= sizeof(espnow_header_t)) && (len <= sizeof(espnow_command_t)) && (len != sizeof(espnow_header_t) + 1) &&
+    (((espnow_header_t*)data)->magic == ESPNOW_MAGIC) && (((espnow_header_t*)data)->type == ESPNOW_ACK)) {
+    Serial.print(F("ESP-NOW ACK packet (#"));
+    Serial.print(((espnow_header_t*)data)->num);
+    if (len > sizeof(espnow_header_t)) {
+      Serial.print(F(", command #"));
+      Serial.print(((espnow_command_t*)data)->id);
+      Serial.print(F(" of "));
+      Serial.print(len - sizeof(espnow_header_t) - 1);
+      Serial.print(F(" bytes"));
     }
+    Serial.println(')');
+    error = false;
   } else if (len == sizeof(espnow_data_t)) {
     if ((((espnow_data_t*)data)->header.magic == ESPNOW_MAGIC) && (((espnow_data_t*)data)->header.type == ESPNOW_DATA)) {
       Serial.print(F("ESP-NOW DATA packet (#"));
@@ -132,48 +488,209 @@ static void dumpPacket(const uint8_t *data, uint8_t len) {
       error = false;
     }
   }
+  if (error && (len > sizeof(espnow_header_t)) && (! ((len - sizeof(espnow_header_t)) % sizeof(payload_t)))) {
+    if ((((espnow_header_t*)data)->magic == ESPNOW_MAGIC) && (((espnow_header_t*)data)->type == ESPNOW_BATCH)) {
+      Serial.print(F("ESP-NOW BATCH packet (#"));
+      Serial.print(((espnow_header_t*)data)->num);
+      Serial.print(F(", "));
+      Serial.print((len - sizeof(espnow_header_t)) / sizeof(payload_t));
+      Serial.println(F(" records)"));
+      error = false;
+    }
+  }
+  if (error && (len > sizeof(espnow_header_t)) && (((espnow_header_t*)data)->magic == ESPNOW_MAGIC) &&
+    (((espnow_header_t*)data)->type == ESPNOW_TLV)) {
+    Serial.print(F("ESP-NOW TLV packet (#"));
+    Serial.print(((espnow_header_t*)data)->num);
+    Serial.print(F(", "));
+    Serial.print(len - sizeof(espnow_header_t));
+    Serial.println(F(" bytes)"));
+    error = false;
+  }
+  if (error && (len > sizeof(espnow_frag_t) - sizeof(espnow_frag_t::data)) && (((espnow_header_t*)data)->magic == ESPNOW_MAGIC) &&
+    (((espnow_header_t*)data)->type == ESPNOW_FRAG)) {
+    Serial.print(F("ESP-NOW FRAG packet (#"));
+    Serial.print(((espnow_header_t*)data)->num);
+    Serial.print(F(", message "));
+    Serial.print(((espnow_frag_t*)data)->msg);
+    Serial.print(F(", "));
+    Serial.print(((espnow_frag_t*)data)->index + 1);
+    Serial.print('/');
+    Serial.print(((espnow_frag_t*)data)->count);
+    Serial.println(')');
+    error = false;
+  }
+  if (error && (len > sizeof(espnow_header_t)) && (! ((len - sizeof(espnow_header_t)) % sizeof(espnow_ack_t)))) {
+    if ((((espnow_header_t*)data)->magic == ESPNOW_MAGIC) && (((espnow_header_t*)data)->type == ESPNOW_ACKS)) {
+      Serial.print(F("ESP-NOW ACKS packet ("));
+      Serial.print((len - sizeof(espnow_header_t)) / sizeof(espnow_ack_t));
+      Serial.println(')');
+      error = false;
+    }
+  }
   if (error) {
     Serial.println(F("Wrong ESP-NOW packet!"));
   }
 }
+#endif
+
+static void traceFlush(uint8_t max) { // Print up to max traced events
+#if TRACE_LEVEL > TRACE_NONE
+  static uint32_t lastLost = 0;
+
+  trace_t t;
+  uint32_t lost;
+
+  while (max-- && trace.get(t)) {
+    switch (t.event) {
+      case EVENT_RECEIVED:
+        Serial.print(F("\nESP-NOW packet received from "));
+        Serial.println(macToString(t.mac));
+        dumpPacket(t.data, t.len);
+        break;
+      case EVENT_MALFORMED_TLV:
+        Serial.println(F("Malformed TLV packet!"));
+        break;
+      case EVENT_RX_OVERFLOW:
+        Serial.println(F("Receive queue overflow!"));
+        break;
+      case EVENT_REASSEMBLY_TIMEOUT:
+        Serial.println(F("Reassembly timeout!"));
+        break;
+      case EVENT_REASSEMBLY_FULL:
+        Serial.println(F("Reassembly memory is full!"));
+        break;
+      case EVENT_WRONG_FRAGMENT:
+        Serial.println(F("Wrong fragment!"));
+        break;
+      case EVENT_WRONG_NUM:
+        Serial.print(F("Wrong num in header (#"));
+        Serial.print(t.data[0] | (t.data[1] << 8));
+        Serial.println(F(")!"));
+        break;
+    }
+  }
+  lost = trace.lost();
+  if (lost != lastLost) {
+    Serial.print(lost - lastLost);
+    Serial.println(F(" trace event(s) lost!"));
+    lastLost = lost;
+  }
+#endif
+}
 
 #ifdef SERVER
 void EspNowServerPlus::end() {
   EspNowServer::end();
-  _peer_count = 0;
+  _peers.clear();
+  memset(_messages, 0, sizeof(_messages));
 }
 
 void EspNowServerPlus::onReceive(const uint8_t *mac, const uint8_t *data, uint8_t len) {
-  Serial.print(F("\nESP-NOW packet received from "));
-  Serial.println(macToString(mac));
-  dumpPacket(data, len);
-  if (isDataPacket(data, len)) {
-    if (! findPeer(mac)) {
-      Serial.print(F("Add new peer "));
-      if (addPeer(mac, ESP_NOW_ROLE_CONTROLLER))
-        Serial.println(F("successful"));
-      else
-        Serial.println(F("fail!"));
-    }
-
-    peer_t *peer = peerByMac(mac);
-
-    if ((! peer) || (peer->num != ((espnow_data_t*)data)->header.num)) {
-      if (! peer) {
-        if (_peer_count < MAX_PEERS) {
-          peer = &_peers[_peer_count++];
-        } else {
-          Serial.println(F("Too many peers!"));
-          return;
-        }
+  uint32_t time = micros();
+
+  if (isProbe(mac, data, len)) // Answered from poll()
+    return;
+  ++metrics.frames;
+  TRACE_D(trace, EVENT_RECEIVED, mac, data, len);
+  if (isDataPacket(data, len) || isBatchPacket(data, len) || isTlvPacket(data, len)) {
+    uint8_t count;
+
+    if (((espnow_header_t*)data)->type == ESPNOW_TLV) {
+      count = unpackTlv(mac, data, len);
+      if (! count) {
+        ++metrics.malformed;
+        TRACE_E(trace, EVENT_MALFORMED_TLV, mac);
+        return;
       }
-      memcpy(peer->mac, mac, sizeof(peer->mac));
-      peer->num = ((espnow_data_t*)data)->header.num;
-      memcpy(&peer->payload, &((espnow_data_t*)data)->payload, sizeof(peer->payload));
-      peer->acknowledged = false;
-      Serial.println(F("Packet from peer cached"));
+    } else {
+      const payload_t *records;
+
+      if (((espnow_header_t*)data)->type == ESPNOW_DATA) {
+        records = &((espnow_data_t*)data)->payload;
+        count = 1;
+      } else {
+        records = ((espnow_batch_t*)data)->records;
+        count = (len - sizeof(espnow_header_t)) / sizeof(payload_t);
+      }
+      for (uint8_t i = 0; i < count; ++i) {
+        memcpy(_batch[i].mac, mac, sizeof(_batch[i].mac));
+        _batch[i].num = ((espnow_header_t*)data)->num;
+        _batch[i].index = i;
+        _batch[i].id = records[i].id;
+        _batch[i].key = SENSOR_UPTIME;
+        _batch[i].wire = TLV_UINT;
+        _batch[i].value = records[i].uptime;
+      }
+    }
+    for (uint8_t i = 0; i < count; ++i) {
+      _batch[i].time = time;
+    }
+    if (_frames.put(_batch, count)) // Whole batch or nothing, so it is acked only when queued
+      _received = true;
+    else
+      TRACE_E(trace, EVENT_RX_OVERFLOW, mac);
+  } else if (isFragPacket(data, len)) {
+    const espnow_frag_t *frag = (espnow_frag_t*)data;
+    uint8_t index = DUP_MESSAGE;
+
+    memcpy(_batch[0].mac, mac, sizeof(_batch[0].mac));
+    _batch[0].num = frag->header.num;
+    _batch[0].index = 0;
+    _batch[0].id = macToId(mac);
+    _batch[0].key = frag->key;
+    _batch[0].wire = TLV_BYTES;
+    _batch[0].time = time;
+    if (! isSeen(&_batch[0])) { // Repeated fragment of a published message is only acked again
+      index = reassemble(mac, frag, len);
+      if (index == ERR_MESSAGE) // Not acked, so it will be repeated
+        return;
+    }
+    _batch[0].value = index < MAX_MESSAGES ? index : MAX_MESSAGES; // Message to publish or MAX_MESSAGES
+    if (_frames.put(_batch[0])) {
       _received = true;
+    } else {
+      TRACE_E(trace, EVENT_RX_OVERFLOW, mac);
+      for (uint8_t i = 0; (index != DUP_MESSAGE) && (i < MAX_MESSAGES); ++i) { // Forget this fragment unless repeated
+        if ((_messages[i].state != MESSAGE_FREE) && (! memcmp(_messages[i].mac, mac, sizeof(_messages[i].mac))) &&
+          (_messages[i].msg == frag->msg)) {
+          _messages[i].received &= ~(1 << frag->index);
+          _messages[i].state = MESSAGE_BUSY;
+        }
+      }
     }
+  } else if ((len > sizeof(espnow_header_t)) && (((espnow_header_t*)data)->magic == ESPNOW_MAGIC) &&
+    (((espnow_header_t*)data)->type == ESPNOW_ACKS)) { // Broadcast of another gateway on this channel
+    return;
+  } else {
+    ++metrics.malformed;
+  }
+}
+
+void EspNowServerPlus::onSendDone(uint8_t handle, const uint8_t *mac, bool success) {
+  peer_t *peer;
+
+  if (isProbeReply(handle)) // Discovery reply, not an ACK
+    return;
+  for (uint8_t i = 0; i < MAX_ACK_TIMINGS; ++i) {
+    if (_ack_timings[i].handle == handle) {
+      if (success)
+        ackLatency.add(micros() - _ack_timings[i].time);
+      _ack_timings[i].handle = 0;
+      break;
+    }
+  }
+  if (success)
+    ++metrics.acks_ok;
+  else
+    ++metrics.acks_failed;
+  if ((mac[0] & 0x01) || (! (peer = peerByMac(mac)))) // Broadcast ACKS or forgotten peer
+    return;
+  peer->acknowledged = success;
+  if (! success) {
+    Serial.print(F("Sending ACK to "));
+    Serial.print(macToString(mac));
+    Serial.println(F(" FAIL!"));
   }
 }
 
@@ -182,79 +699,592 @@ bool EspNowServerPlus::isDataPacket(const uint8_t *data, uint8_t len) {
     (((espnow_data_t*)data)->header.type == ESPNOW_DATA);
 }
 
-bool EspNowServerPlus::sendAck(const uint8_t *mac) {
+bool EspNowServerPlus::isBatchPacket(const uint8_t *data, uint8_t len) {
+  return (len > sizeof(espnow_header_t)) && (! ((len - sizeof(espnow_header_t)) % sizeof(payload_t))) &&
+    (((espnow_header_t*)data)->magic == ESPNOW_MAGIC) && (((espnow_header_t*)data)->type == ESPNOW_BATCH);
+}
+
+bool EspNowServerPlus::isTlvPacket(const uint8_t *data, uint8_t len) {
+  return (len > sizeof(espnow_header_t)) && (((espnow_header_t*)data)->magic == ESPNOW_MAGIC) &&
+    (((espnow_header_t*)data)->type == ESPNOW_TLV);
+}
+
+uint8_t EspNowServerPlus::unpackTlv(const uint8_t *mac, const uint8_t *data, uint8_t len) {
+  TlvView view(((espnow_tlv_t*)data)->data, len - sizeof(espnow_header_t));
+  tlv_item_t item;
+  uint32_t id = macToId(mac);
+  uint8_t count = 0;
+
+  while (view.next(item)) {
+    if (item.key == SENSOR_ID) {
+      id = item.value;
+    } else if (item.wire != TLV_BYTES) {
+      if (count >= MAX_RECORDS)
+        return 0;
+      memcpy(_batch[count].mac, mac, sizeof(_batch[count].mac));
+      _batch[count].num = ((espnow_header_t*)data)->num;
+      _batch[count].index = count;
+      _batch[count].id = id;
+      _batch[count].key = (sensor_key_t)item.key;
+      _batch[count].wire = item.wire;
+      _batch[count].value = item.value;
+      ++count;
+    }
+  }
+
+  return view.error() ? 0 : count;
+}
+
+bool EspNowServerPlus::isFragPacket(const uint8_t *data, uint8_t len) {
+  const espnow_frag_t *frag = (espnow_frag_t*)data;
+
+  return (len > sizeof(espnow_frag_t) - sizeof(frag->data)) && (frag->header.magic == ESPNOW_MAGIC) &&
+    (frag->header.type == ESPNOW_FRAG) && frag->count && (frag->count <= ESPNOW_MAX_FRAGMENTS) && (frag->index < frag->count) &&
+    ((frag->index == frag->count - 1) || (len == sizeof(espnow_frag_t)));
+}
+
+uint8_t EspNowServerPlus::reassemble(const uint8_t *mac, const espnow_frag_t *frag, uint8_t len) {
+  const uint8_t FRAG_HEADER = sizeof(espnow_frag_t) - sizeof(frag->data);
+
+  message_t *message = NULL;
+  uint8_t index = ERR_MESSAGE;
+
+  for (uint8_t i = 0; i < MAX_MESSAGES; ++i) {
+    if (((_messages[i].state == MESSAGE_DONE) || (_messages[i].state == MESSAGE_HELD)) &&
+      (! memcmp(_messages[i].mac, mac, sizeof(_messages[i].mac))) && (_messages[i].msg == frag->msg)) // Not published yet
+      return DUP_MESSAGE;
+    if (_messages[i].state == MESSAGE_BUSY) {
+      if ((! memcmp(_messages[i].mac, mac, sizeof(_messages[i].mac))) && (_messages[i].msg == frag->msg)) {
+        message = &_messages[i];
+        index = i;
+        break;
+      }
+      if (millis() - _messages[i].time >= REASSEMBLY_TIMEOUT) {
+        TRACE_I(trace, EVENT_REASSEMBLY_TIMEOUT, _messages[i].mac);
+        _messages[i].state = MESSAGE_FREE;
+      }
+    }
+    if ((_messages[i].state == MESSAGE_FREE) && (index == ERR_MESSAGE))
+      index = i;
+  }
+  if (! message) {
+    uint16_t offset = ERR_OFFSET;
+
+    if (index != ERR_MESSAGE)
+      offset = allocMessage(frag->count * sizeof(frag->data));
+    if (offset == ERR_OFFSET) {
+      TRACE_E(trace, EVENT_REASSEMBLY_FULL, mac);
+      return ERR_MESSAGE;
+    }
+    message = &_messages[index];
+    memcpy(message->mac, mac, sizeof(message->mac));
+    message->msg = frag->msg;
+    message->count = frag->count;
+    message->received = 0;
+    message->offset = offset;
+    message->time = millis();
+    message->state = MESSAGE_BUSY;
+  } else if (message->count != frag->count) {
+    ++metrics.malformed;
+    TRACE_E(trace, EVENT_WRONG_FRAGMENT, mac);
+    return ERR_MESSAGE;
+  }
+  if (message->received & (1 << frag->index)) // Just ack it again
+    return DUP_MESSAGE;
+  memcpy(&_arena[message->offset + frag->index * sizeof(frag->data)], frag->data, len - FRAG_HEADER);
+  message->received |= 1 << frag->index;
+  if (frag->index == frag->count - 1)
+    message->length = frag->index * sizeof(frag->data) + len - FRAG_HEADER;
+  if (message->received == (uint16_t)((1UL << message->count) - 1)) {
+    message->state = MESSAGE_DONE;
+    return index;
+  }
+
+  return MAX_MESSAGES;
+}
+
+uint16_t EspNowServerPlus::allocMessage(uint16_t size) {
+  uint16_t offset = 0;
+  bool moved;
+
+  do { // First fit, skip past every region the candidate overlaps
+    moved = false;
+    for (uint8_t i = 0; i < MAX_MESSAGES; ++i) {
+      if (_messages[i].state != MESSAGE_FREE) {
+        uint16_t end = _messages[i].offset + _messages[i].count * sizeof(espnow_frag_t::data);
+
+        if ((offset < end) && (offset + size > _messages[i].offset)) {
+          offset = end;
+          moved = true;
+        }
+      }
+    }
+  } while (moved && (offset + size <= ARENA_SIZE));
+
+  return offset + size <= ARENA_SIZE ? offset : ERR_OFFSET;
+}
+
+bool EspNowServerPlus::sendAck(const uint8_t *mac, uint16_t num, uint32_t time) {
   const uint8_t REPEAT = 2;
-  const uint32_t GAP = 1; // 1 ms.
 
   peer_t *peer = peerByMac(mac);
 
   if (peer) {
-    espnow_header_t header;
+    espnow_command_t ack;
+    mailbox_t *command;
+    uint8_t len = sizeof(ack.header);
+    uint8_t handle;
+
+    if (! usePeer(peer->mac)) { // Register in SDK only for unicast, evicting LRU peer
+      Serial.println(F("Add peer fail!"));
+      ++metrics.acks_failed;
+      return false;
+    }
 
-    header.magic = ESPNOW_MAGIC;
-    header.type = ESPNOW_ACK;
-    header.num = peer->num;
-    if (esp_now->sendReliable(peer->mac, (uint8_t*)&header, sizeof(header), REPEAT, GAP)) {
-      peer->acknowledged = true;
+    ack.header.magic = ESPNOW_MAGIC;
+    ack.header.type = ESPNOW_ACK;
+    ack.header.num = num;
+    command = commandFor(macToId(peer->mac));
+    if (command) { // Downlink rides on ACK, client is awake right now
+      ack.id = command->seq;
+      memcpy(ack.data, command->data, command->len);
+      len += sizeof(ack.id) + command->len;
+    }
+    handle = sendAsync(peer->mac, (uint8_t*)&ack, len, REPEAT);
+    if (handle) {
+      timeAck(handle, time);
+      peer->acknowledged = true; // Until onSendDone() reports failure
       return true;
     }
+    ++metrics.acks_failed;
   }
 
   return false;
 }
 
-EspNowServerPlus::peer_t *EspNowServerPlus::peerByMac(const uint8_t *mac) {
-  for (uint8_t i = 0; i < _peer_count; ++i) {
-    if (! memcmp(_peers[i].mac, mac, sizeof(_peers[i].mac)))
-      return &_peers[i];
+void EspNowServerPlus::timeAck(uint8_t handle, uint32_t time) {
+  _ack_timings[_ack_timing].handle = handle; // Oldest one is overwritten, its ACK is most likely done
+  _ack_timings[_ack_timing].time = time;
+  _ack_timing = (_ack_timing + 1) % MAX_ACK_TIMINGS;
+}
+
+bool EspNowServerPlus::queueAck(peer_t *peer, uint16_t num, uint32_t time) {
+  bool result = true;
+
+  if (_ack_count >= ESPNOW_MAX_ACKS)
+    result = flushAcks();
+  memcpy(_acks.acks[_ack_count].id, &peer->mac[3], sizeof(_acks.acks[_ack_count].id));
+  _acks.acks[_ack_count].num = num;
+  _ack_times[_ack_count] = time;
+  _ack_peers[_ack_count++] = peer;
+  peer->ack_num = num;
+  peer->ack_time = millis();
+
+  return result;
+}
+
+bool EspNowServerPlus::flushAcks() {
+  bool result = true;
+  bool sent;
+  uint8_t count = 0;
+
+  if (! _ack_count)
+    return true;
+  if (_ack_count > 1) { // Peers with pending command get own ACK carrying it
+    for (uint8_t i = 0; i < _ack_count; ++i) {
+      if (commandFor(macToId(_ack_peers[i]->mac))) {
+        if (! sendAck(_ack_peers[i]->mac, _acks.acks[i].num, _ack_times[i]))
+          result = false;
+      } else {
+        _acks.acks[count] = _acks.acks[i];
+        _ack_times[count] = _ack_times[i];
+        _ack_peers[count++] = _ack_peers[i];
+      }
+    }
+    _ack_count = count;
+    if (! _ack_count)
+      return result;
+  }
+  if (_ack_count == 1) { // Unicast is retried by MAC layer
+    Serial.print(F("Sending ACK "));
+    sent = sendAck(_ack_peers[0]->mac, _acks.acks[0].num, _ack_times[0]);
+  } else {
+    Serial.print(F("Broadcasting "));
+    Serial.print(_ack_count);
+    Serial.print(F(" ACKs "));
+    _acks.header.magic = ESPNOW_MAGIC;
+    _acks.header.type = ESPNOW_ACKS;
+    _acks.header.num = 0;
+    {
+      const uint8_t BROADCAST[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+      uint8_t handle = sendAsync(BROADCAST, (uint8_t*)&_acks, sizeof(_acks.header) + sizeof(espnow_ack_t) * _ack_count);
+
+      sent = handle != 0;
+      if (sent)
+        timeAck(handle, _ack_times[0]); // Queued first, so oldest
+    }
+    if (sent) {
+      for (uint8_t i = 0; i < _ack_count; ++i) {
+        _ack_peers[i]->acknowledged = true;
+      }
+    } else {
+      metrics.acks_failed += _ack_count;
+    }
+  }
+  if (sent)
+    Serial.println(F("OK"));
+  else
+    Serial.println(F("FAIL!"));
+  _ack_count = 0;
+
+  return sent && result;
+}
+
+EspNowServerPlus::mailbox_t *EspNowServerPlus::commandFor(uint32_t id) {
+  for (uint8_t i = 0; i < MAX_MAILBOX; ++i) {
+    if (_mailbox[i].seq && (_mailbox[i].id == id))
+      return &_mailbox[i];
   }
 
   return NULL;
 }
 
+void EspNowServerPlus::confirmCommand(uint32_t id, uint8_t seq) {
+  mailbox_t *command = commandFor(id);
+
+  if (command && (command->seq == seq)) { // Otherwise echo of a replaced one
+    Serial.print(F("Command #"));
+    Serial.print(seq);
+    Serial.print(F(" delivered in "));
+    Serial.print(millis() - command->time);
+    Serial.println(F(" ms."));
+    command->seq = 0;
+  }
+}
+
+void EspNowServerPlus::expireCommands() {
+  for (uint8_t i = 0; i < MAX_MAILBOX; ++i) {
+    if (_mailbox[i].seq && (millis() - _mailbox[i].time >= COMMAND_TTL)) {
+      Serial.print(F("Command #"));
+      Serial.print(_mailbox[i].seq);
+      Serial.println(F(" expired undelivered"));
+      _mailbox[i].seq = 0;
+    }
+  }
+}
+
+bool EspNowServerPlus::postCommand(uint32_t id, const uint8_t *data, uint8_t len) {
+  mailbox_t *command;
+  peer_t *peer;
+  uint16_t i;
+
+  if ((! len) || (len > ESPNOW_MAX_COMMAND))
+    return false;
+  for (i = 0; i < _peers.size(); ++i) { // Rare, so scan instead of a table by ID
+    if (_peers.used(i) && (macToId(_peers[i].mac) == id))
+      break;
+  }
+  if (i >= _peers.size())
+    return false;
+  peer = &_peers[i];
+  command = commandFor(id); // Replaced by the latest one
+  for (i = 0; (! command) && (i < MAX_MAILBOX); ++i) {
+    if (! _mailbox[i].seq)
+      command = &_mailbox[i];
+  }
+  if (! command)
+    return false;
+  command->id = id;
+  command->time = millis();
+  if (! ++peer->command_seq)
+    ++peer->command_seq;
+  command->seq = peer->command_seq;
+  command->len = len;
+  memcpy(command->data, data, len);
+
+  return true;
+}
+
+EspNowServerPlus::peer_t *EspNowServerPlus::peerByMac(const uint8_t *mac) {
+  return _peers.find(mac);
+}
+
+bool EspNowServerPlus::isSeen(const frame_t *frame) {
+  peer_t *peer = peerByMac(frame->mac);
+  int16_t diff;
+
+  if (! peer)
+    return false;
+  diff = frame->num - peer->num;
+
+  return (diff <= 0) && (diff > -64) && (peer->window & ((uint64_t)1 << -diff));
+}
+
+EspNowServerPlus::peer_t *EspNowServerPlus::peerByFrame(const frame_t *frame, bool *fresh) {
+  peer_t *peer = peerByMac(frame->mac);
+  int16_t diff; // Wraps around with num
+
+  if (! peer) {
+    peer = _peers.add(frame->mac);
+    if (! peer) {
+      Serial.println(F("Too many peers!"));
+      *fresh = false;
+      return NULL;
+    }
+    idToTopic(peer->topic_id, macToId(peer->mac));
+    peer->command_seq = random(0x100); // Client may remember an id from before gateway restart
+    diff = MAX_GAP + 1;
+  } else {
+    diff = frame->num - peer->num;
+  }
+  if ((diff > MAX_GAP) || (diff <= -64)) { // New or restarted client, start a new window
+    peer->window = ~(uint64_t)0; // Nothing before it counts as lost
+    peer->num = frame->num;
+    *fresh = true;
+  } else if (diff > 0) { // Ahead of window, slide it
+    uint16_t lost;
+
+    if (diff < 64) {
+      lost = diff - __builtin_popcountll(peer->window >> (64 - diff));
+      peer->window = (peer->window << diff) | 1;
+    } else {
+      lost = 64 - __builtin_popcountll(peer->window) + diff - 64;
+      peer->window = 1;
+    }
+    if (lost) {
+      peer->lost += lost;
+      metrics.lost += lost;
+      Serial.print(lost);
+      Serial.println(F(" packet(s) from peer lost"));
+    }
+    peer->num = frame->num;
+    *fresh = true;
+  } else { // Inside window, out of order or duplicate
+    *fresh = ! (peer->window & ((uint64_t)1 << -diff));
+    peer->window |= (uint64_t)1 << -diff;
+    if (*fresh) {
+      ++peer->reordered;
+      ++metrics.reordered;
+    }
+  }
+  if (*fresh) {
+    ++peer->received;
+    peer->acknowledged = false;
+    Serial.println(F("Packet from peer cached"));
+  } else {
+    ++peer->duplicates;
+    ++metrics.duplicates;
+  }
+
+  return peer;
+}
+
 #else
+bool EspNowClientPlus::begin() {
+  uint8_t mac[6];
+
+  WiFi.macAddress(mac);
+  memcpy(_id, &mac[3], sizeof(_id));
+  _num = random(0x10000); // So the gateway doesn't take new frames for duplicates after restart
+  _base = _num + 1;
+
+  return EspNowClient::begin();
+}
+
 void EspNowClientPlus::onReceive(const uint8_t *mac, const uint8_t *data, uint8_t len) {
-  Serial.print(F("\nESP-NOW packet received from "));
-  Serial.println(macToString(mac));
-  dumpPacket(data, len);
+  TRACE_D(trace, EVENT_RECEIVED, mac, data, len);
   if (isAckPacket(data, len)) {
-    if (((espnow_header_t*)data)->num == _num) {
-      _received = true;
-    } else {
-      Serial.println(F("Wrong num in header!"));
+    ack(((espnow_header_t*)data)->num);
+    if (len > sizeof(espnow_header_t) + 1) {
+      const espnow_command_t *command = (const espnow_command_t*)data;
+
+      if (! _command_len) { // Otherwise dropped unconfirmed, gateway repeats it with next ACK
+        if (command->id != _command_id) {
+          _command_id = command->id;
+          memcpy(_command, command->data, len - sizeof(espnow_header_t) - 1);
+          _command[len - sizeof(espnow_header_t) - 1] = '\0';
+          _command_len = len - sizeof(espnow_header_t) - 1;
+        }
+        _command_echo = true; // Repeated one too, its echo may be lost
+      }
+    }
+  } else if (isAcksPacket(data, len)) {
+    const espnow_ack_t *acks = ((espnow_acks_t*)data)->acks;
+
+    for (uint8_t i = 0; i < (len - sizeof(espnow_header_t)) / sizeof(espnow_ack_t); ++i) {
+      if (! memcmp(acks[i].id, _id, sizeof(_id)))
+        ack(acks[i].num);
     }
   }
 }
 
 bool EspNowClientPlus::isAckPacket(const uint8_t *data, uint8_t len) {
-  return (len == sizeof(espnow_header_t)) && (((espnow_header_t*)data)->magic == ESPNOW_MAGIC) &&
+  return (len >= sizeof(espnow_header_t)) && (len <= sizeof(espnow_command_t)) && (len != sizeof(espnow_header_t) + 1) && (((espnow_header_t*)data)->magic == ESPNOW_MAGIC) &&
     (((espnow_header_t*)data)->type == ESPNOW_ACK);
 }
 
+bool EspNowClientPlus::isAcksPacket(const uint8_t *data, uint8_t len) {
+  return (len > sizeof(espnow_header_t)) && (! ((len - sizeof(espnow_header_t)) % sizeof(espnow_ack_t))) &&
+    (((espnow_header_t*)data)->magic == ESPNOW_MAGIC) && (((espnow_header_t*)data)->type == ESPNOW_ACKS);
+}
+
+void EspNowClientPlus::ack(uint16_t num) {
+  if ((uint16_t)(num - _base) < (uint16_t)(_num + 1 - _base)) { // Inside window
+    slot_t *slot = &_window[num % WINDOW];
+
+    if (slot->state == SLOT_WAIT) {
+      slot->state = SLOT_ACKED;
+      _received = true;
+      ackLatency.add(micros() - slot->sent);
+    }
+  } else if ((uint16_t)(num - _base) < 0x8000) { // Not a late duplicate
+    TRACE_I(trace, EVENT_WRONG_NUM, NULL, &num, sizeof(num));
+  }
+}
+
+void EspNowClientPlus::onSendDone(uint8_t handle, const uint8_t *mac, bool success) {
+  for (uint16_t num = _base; num != (uint16_t)(_num + 1); ++num) {
+    slot_t *slot = &_window[num % WINDOW];
+
+    if (slot->handle == handle) {
+      slot->handle = 0;
+      slot->start = millis();
+      if (success)
+        txLatency.add(micros() - slot->tx);
+      else // Failed attempt is repeated without waiting for ACK
+        slot->start -= slot->wait;
+      break;
+    }
+  }
+}
+
 bool EspNowClientPlus::sendData() {
-  const uint8_t REPEAT = 5;
-  const uint32_t GAP = 1; // 1 ms.
-
-  uint8_t repeat = REPEAT;
-  espnow_data_t data;
-  uint32_t start;
-
-  data.header.magic = ESPNOW_MAGIC;
-  data.header.type = ESPNOW_DATA;
-  data.header.num = ++_num;
-  data.payload.id = ESP.getChipId();
-  data.payload.uptime = millis();
-  _received = false;
-  while ((! _received) && repeat--) {
-    if (esp_now->sendReliable(_server_mac, (uint8_t*)&data, sizeof(data), 1, GAP)) {
-      start = millis();
-      while ((! _received) && (millis() - start < GAP + 1)) {
-        delay(1);
+  const uint8_t MAX_READING_SIZE = 1 + 5; // SENSOR_UPTIME varint
+
+  if (_batch_count && (_writer.length() > sizeof(_batch.data) - MAX_READING_SIZE) && (! sendBatch()))
+    return false;
+  if (! _batch_count)
+    startBatch();
+  _writer.putUInt(SENSOR_UPTIME, millis());
+  ++_batch_count;
+  poll();
+
+  return true;
+}
+
+void EspNowClientPlus::startBatch() {
+  _batch_start = millis();
+  _writer.clear();
+  _writer.putUInt(SENSOR_ID, ESP.getChipId());
+}
+
+bool EspNowClientPlus::sendBatch() {
+  slot_t *slot;
+
+  if ((uint16_t)(_num + 1 - _base) >= WINDOW) // Before echo is added, so it isn't lost
+    return false;
+  if (_command_echo && _writer.putUInt(SENSOR_COMMAND, _command_id))
+    _command_echo = false;
+  slot = addSlot(ESPNOW_TLV, sizeof(espnow_header_t) + _writer.length());
+  if (! slot)
+    return false;
+  memcpy(slot->data.tlv.data, _batch.data, _writer.length());
+  _batch_count = 0;
+
+  return true;
+}
+
+bool EspNowClientPlus::sendMessage(sensor_key_t key, const uint8_t *data, uint16_t len) {
+  if (_message || (! len) || (len > ESPNOW_MAX_MESSAGE))
+    return false;
+  _message = data;
+  _message_len = len;
+  _message_key = key;
+  ++_message_id;
+  _fragment = 0;
+  poll();
+
+  return true;
+}
+
+bool EspNowClientPlus::sendFragment() {
+  const uint8_t FRAG_DATA = sizeof(espnow_frag_t::data);
+
+  uint8_t count = (_message_len + FRAG_DATA - 1) / FRAG_DATA;
+  uint8_t len = _fragment < count - 1 ? FRAG_DATA : _message_len - _fragment * FRAG_DATA;
+  slot_t *slot = addSlot(ESPNOW_FRAG, sizeof(espnow_frag_t) - FRAG_DATA + len);
+
+  if (! slot)
+    return false;
+  slot->data.frag.msg = _message_id;
+  slot->data.frag.index = _fragment;
+  slot->data.frag.count = count;
+  slot->data.frag.key = _message_key;
+  memcpy(slot->data.frag.data, &_message[_fragment * FRAG_DATA], len);
+  if (++_fragment >= count)
+    _message = NULL;
+
+  return true;
+}
+
+EspNowClientPlus::slot_t *EspNowClientPlus::addSlot(espnow_type_t type, uint8_t len) {
+  slot_t *slot;
+
+  if ((uint16_t)(_num + 1 - _base) >= WINDOW)
+    return NULL;
+  slot = &_window[++_num % WINDOW];
+  slot->data.header.magic = ESPNOW_MAGIC;
+  slot->data.header.type = type;
+  slot->data.header.num = _num;
+  slot->len = len;
+  slot->handle = 0;
+  slot->repeat = REPEAT;
+  slot->rounds = 0;
+  slot->wait = ACK_TIMEOUT;
+  slot->start = millis() - ACK_TIMEOUT; // Send at once
+  slot->state = SLOT_WAIT;
+
+  return slot;
+}
+
+void EspNowClientPlus::poll() {
+  EspNowClient::poll();
+  if (_command_echo) // Confirm received command now, not when batch is full
+    flush();
+  else if (_batch_count && ((_batch_count >= BATCH_RECORDS) || (millis() - _batch_start >= BATCH_AGE)))
+    sendBatch();
+  while (_message && sendFragment());
+  // Every unacknowledged slot is repeated independently (selective repeat)
+  for (uint16_t num = _base; num != (uint16_t)(_num + 1); ++num) {
+    slot_t *slot = &_window[num % WINDOW];
+
+    if ((slot->state == SLOT_WAIT) && (! slot->handle) && (millis() - slot->start >= slot->wait)) {
+      if (slot->repeat) {
+        slot->handle = sendAsync(_server_mac, (uint8_t*)&slot->data, slot->len, 0, ACK_TIMEOUT);
+        if (slot->handle) { // Otherwise send queue is full, try again next time
+          slot->tx = micros();
+          if ((slot->repeat == REPEAT) && (! slot->rounds))
+            slot->sent = slot->tx;
+          --slot->repeat;
+          slot->wait = ACK_TIMEOUT;
+        }
+      } else if (slot->rounds < BACKOFF_ROUNDS) {
+        slot->repeat = REPEAT;
+        slot->wait = BACKOFF << slot->rounds++;
+        slot->start = millis();
+      } else {
+        slot->state = SLOT_FAILED;
       }
     }
   }
-
-  return _received;
+  while ((_base != (uint16_t)(_num + 1)) && (_window[_base % WINDOW].state != SLOT_WAIT)) {
+    if (_window[_base % WINDOW].state == SLOT_ACKED)
+      ++_oks;
+    else
+      ++_fails;
+    ++_base;
+  }
 }
 #endif
 
@@ -278,6 +1308,92 @@ static void reboot(const __FlashStringHelper *msg) {
   ESP.restart();
 }
 
+#ifndef SERVER
+static const uint8_t MAX_SERVERS = 4; // Ranked gateways to fail over to
+
+struct rtc_state_t { // Kept in RTC memory over restart and deep sleep, naturally aligned to 4 byte blocks
+  uint32_t magic;
+  uint16_t num; // Last sent
+  uint8_t server_count;
+  uint8_t server; // Index of used one
+  uint8_t fails; // Wake ups in a row without ACK
+  uint8_t channel; // Last used, probed first
+  uint8_t command_id; // Last received, its repeat after wake is only confirmed
+  bool command_echo; // Confirmation of command_id is not sent yet
+  espnow_server_t servers[MAX_SERVERS]; // Best first
+  uint16_t checksum;
+};
+
+static const uint32_t RTC_MAGIC = 0x574E514E; // "NQNW"
+#ifdef DEEP_SLEEP
+static const uint32_t SLEEP_PERIOD = 5000; // 5 sec.
+static const uint32_t MAX_AWAKE = 300; // 300 ms. after send, give up waiting for ACK
+static const uint8_t MAX_WAKE_FAILS = 3; // Fail over to next server after so many
+#endif
+
+static rtc_state_t rtcState;
+#ifdef DEEP_SLEEP
+static uint32_t sendStart;
+#endif
+
+static uint16_t rtcChecksum() {
+  const uint8_t *data = (const uint8_t*)&rtcState;
+  uint16_t result = 0;
+
+  for (uint8_t i = 0; i < offsetof(rtc_state_t, checksum); ++i) {
+    result = ((result << 1) | (result >> 15)) ^ data[i];
+  }
+
+  return result;
+}
+
+static bool rtcLoad() { // false after power on
+  return ESP.rtcUserMemoryRead(0, (uint32_t*)&rtcState, sizeof(rtcState)) && (rtcState.magic == RTC_MAGIC) &&
+    (rtcState.checksum == rtcChecksum());
+}
+
+static void rtcSave() {
+  rtcState.magic = RTC_MAGIC;
+  rtcState.checksum = rtcChecksum();
+  ESP.rtcUserMemoryWrite(0, (uint32_t*)&rtcState, sizeof(rtcState));
+}
+
+static uint8_t findServers() { // Into RTC state
+  rtcState.server_count = espNowFindServers(rtcState.servers, MAX_SERVERS, rtcState.channel);
+  rtcState.server = 0;
+  rtcState.fails = 0;
+
+  return rtcState.server_count;
+}
+
+static bool nextServer() { // Fail over to next ranked one, false if there is none
+  if (rtcState.server + 1 >= rtcState.server_count)
+    return false;
+  ++rtcState.server;
+  rtcState.fails = 0;
+  rtcState.channel = rtcState.servers[rtcState.server].channel;
+
+  return true;
+}
+
+#ifdef DEEP_SLEEP
+static void sleep() {
+  uint32_t awake = millis();
+
+  rtcSave();
+  traceFlush(0xFF);
+  Serial.print(F("Deep sleep after "));
+  Serial.print(awake);
+  Serial.println(F(" ms. awake"));
+  Serial.flush();
+  if (led)
+    led->setMode(LED_OFF);
+
+  ESP.deepSleep((uint64_t)(awake < SLEEP_PERIOD ? SLEEP_PERIOD - awake : 1) * 1000);
+}
+#endif
+#endif
+
 #ifdef SERVER
 static void wifiConnect() {
   const uint32_t WIFI_CONNECT_TIMEOUT = 60000; // 60 sec.
@@ -299,6 +1415,7 @@ static void wifiConnect() {
 }
 
 static void mqttConnect();
+static void mqttSubscribe();
 
 static void onWifiConnected(const WiFiEventStationModeGotIP &event) {
   Serial.print(F("\nConnected to WiFi (IP: "));
@@ -309,12 +1426,22 @@ static void onWifiConnected(const WiFiEventStationModeGotIP &event) {
   if (mqtt)
     mqttConnect();
 #endif
-  Serial.print(F("Starting ESP-NOW server "));
-  esp_now = new EspNowServerPlus();
-  if (esp_now->begin()) {
-    Serial.println(F("successful"));
-  } else {
-    reboot(F("FAIL!"));
+  if (! esp_now) {
+    Serial.print(F("Starting ESP-NOW server "));
+    esp_now = new EspNowServerPlus();
+    if (esp_now->begin()) {
+      Serial.println(F("successful"));
+    } else {
+      reboot(F("FAIL!"));
+    }
+  } else if (esp_now->channel() != WiFi.channel()) { // AP follows STA channel, clients have to find it again
+    Serial.print(F("Moving ESP-NOW server to channel "));
+    Serial.print(WiFi.channel());
+    if (((EspNowServerPlus*)esp_now)->setChannel(WiFi.channel())) {
+      Serial.println(F(" successful"));
+    } else {
+      reboot(F(" FAIL!"));
+    }
   }
   wifiLastConnecting = 0;
 }
@@ -322,11 +1449,7 @@ static void onWifiConnected(const WiFiEventStationModeGotIP &event) {
 static void onWifiDisconnected(const WiFiEventStationModeDisconnected &event) {
   Serial.println(F("\nDisconnected from WiFi"));
   led->setMode(LED_OFF);
-  if (esp_now) {
-    delete esp_now;
-    esp_now = NULL;
-    Serial.println(F("ESP-NOW server stopped"));
-  }
+  // ESP-NOW server keeps running on its channel, readings are buffered until MQTT is back
 }
 
 static void mqttConnect() {
@@ -341,10 +1464,12 @@ static void mqttConnect() {
     mqttLastConnecting = millis();
 #else
     Serial.print(F("Connecting to MQTT broker..."));
-    if (mqtt->connect(MQTT_CLIENT)) {
+    if (mqtt->connect(mqttClientId)) {
       Serial.println(F(" successful"));
       led->setMode(LED_FADEINOUT);
       mqttLastConnecting = 0;
+      logDrain = readingsLog.count() != 0;
+      mqttSubscribe();
     } else {
       Serial.print(F(" FAIL ("));
       Serial.print(mqtt->state());
@@ -356,51 +1481,248 @@ static void mqttConnect() {
   }
 }
 
+static void mqttSubscribe() { // To commands of every client
+  char topic[sizeof(MQTT_PREFIX) - 1 + sizeof(MQTT_COMMAND_TOPIC) - 1 + 2];
+
+  strcpy_P(topic, MQTT_PREFIX);
+  strcat_P(topic, MQTT_COMMAND_TOPIC);
+  strcat(topic, "+");
+#ifdef ASYNC_MQTT
+  mqtt->subscribe(topic, MQTT_QOS);
+#else
+  mqtt->subscribe(topic);
+#endif
+}
+
+static void mqttCommand(const char *topic, const uint8_t *payload, uint32_t len) {
+  command_t command;
+  uint8_t i;
+
+  if (strncmp_P(topic, MQTT_PREFIX, sizeof(MQTT_PREFIX) - 1))
+    return;
+  topic += sizeof(MQTT_PREFIX) - 1;
+  if (strncmp_P(topic, MQTT_COMMAND_TOPIC, sizeof(MQTT_COMMAND_TOPIC) - 1))
+    return;
+  topic += sizeof(MQTT_COMMAND_TOPIC) - 1;
+  command.id = 0;
+  for (i = 0; i < 8; ++i) {
+    char c = topic[i];
+
+    if ((c >= '0') && (c <= '9'))
+      command.id = (command.id << 4) | (c - '0');
+    else if ((c >= 'A') && (c <= 'F'))
+      command.id = (command.id << 4) | (c - 'A' + 10);
+    else if ((c >= 'a') && (c <= 'f'))
+      command.id = (command.id << 4) | (c - 'a' + 10);
+    else
+      break;
+  }
+  if ((i < 8) || topic[8] || (! len) || (len > sizeof(command.data))) {
+    Serial.println(F("Wrong MQTT command!"));
+    return;
+  }
+  command.len = len;
+  memcpy(command.data, payload, len);
+  if (! mqttCommands.put(command))
+    Serial.println(F("MQTT command queue is full!"));
+}
+
 #ifdef ASYNC_MQTT
 static void onMqttConnected(bool sessionPresent) {
   Serial.println(F("\nConnected to MQTT broker"));
   led->setMode(LED_FADEINOUT);
   mqttLastConnecting = 0;
+  logDrain = readingsLog.count() != 0;
+  mqttSubscribe();
+}
+
+static void onMqttMessage(char *topic, char *payload, AsyncMqttClientMessageProperties properties, size_t len, size_t index, size_t total) {
+  if ((! index) && (len == total)) // Commands are short, longer ones are rejected anyway
+    mqttCommand(topic, (const uint8_t*)payload, len);
+}
+#else
+static void onMqttMessage(char *topic, uint8_t *payload, unsigned int len) {
+  mqttCommand(topic, payload, len);
 }
 #endif
 
-static bool mqttPublish(const char *topic, const char *value, uint32_t id) {
+static const char *mqttRenderTopic(uint8_t key, const char *id) { // id is idToTopic() rendered
+  char *topic = &mqttTopic[sizeof(MQTT_PREFIX) - 1]; // Prefix is rendered once in setup()
+
+  if ((key < sizeof(MQTT_TOPICS) / sizeof(MQTT_TOPICS[0])) && pgm_read_ptr(&MQTT_TOPICS[key])) {
+    strcpy_P(topic, (PGM_P)pgm_read_ptr(&MQTT_TOPICS[key]));
+    topic += strlen(topic);
+  } else {
+    strcpy_P(topic, PSTR("/sensor"));
+    ultoa(key, &topic[7], 10);
+    topic += strlen(topic);
+  }
+  *topic++ = '/';
+  memcpy(topic, id, 8);
+  topic[8] = '\0';
+
+  return mqttTopic;
+}
+
+static bool mqttPublish(const char *topic, const char *value, uint16_t length = 0) { // length 0 means string value
   bool result = false;
 
   if (mqtt->connected()) {
-    char *_topic;
-
-    _topic = new char[sizeof(MQTT_PREFIX) + strlen(topic) + 1 + 8];
-    if (_topic) {
-      strcpy_P(_topic, MQTT_PREFIX);
-      strcat(_topic, topic);
-      sprintf_P(&_topic[strlen(_topic)], PSTR("/%08X"), id);
-      Serial.print(F("Publishing MQTT topic \""));
-      Serial.print(_topic);
+    Serial.print(F("Publishing MQTT topic \""));
+    Serial.print(topic);
+    if (length) {
+      Serial.print(F("\" with "));
+      Serial.print(length);
+      Serial.println(F(" bytes"));
+    } else {
       Serial.print(F("\" with value \""));
       Serial.print(value);
       Serial.println('"');
+      length = strlen(value);
+    }
 #ifdef ASYNC_MQTT
-      result = mqtt->publish(_topic, MQTT_QOS, MQTT_RETAIN, value);
+    result = mqtt->publish(topic, MQTT_QOS, MQTT_RETAIN, value, length);
 #else
-      result = mqtt->publish(_topic, value, MQTT_RETAIN);
+    result = mqtt->publish(topic, (const uint8_t*)value, length, MQTT_RETAIN);
 #endif
-      delete[] _topic;
-    } else {
-      Serial.println(F("Not enough memory!"));
-    }
+    if (! result)
+      ++metrics.publishes_failed;
   }
 
   return result;
 }
+
+static bool mqttPublish(const publish_t *publish) {
+  if (publish->wire == TLV_SINT)
+    ltoa(TlvView::toSInt(publish->value), mqttValue, 10);
+  else
+    ultoa(publish->value, mqttValue, 10);
+
+  return mqttPublish(mqttRenderTopic(publish->key, publish->topic_id), mqttValue);
+}
+
+static void mqttMetrics(uint16_t peers) { // peers is occupancy of gateway peer table
+  static const char METRIC_FRAMES[] PROGMEM = "frames";
+  static const char METRIC_MALFORMED[] PROGMEM = "malformed";
+  static const char METRIC_DUPLICATES[] PROGMEM = "duplicates";
+  static const char METRIC_REORDERED[] PROGMEM = "reordered";
+  static const char METRIC_LOST[] PROGMEM = "lost";
+  static const char METRIC_ACKS_OK[] PROGMEM = "acks_ok";
+  static const char METRIC_ACKS_FAILED[] PROGMEM = "acks_failed";
+  static const char METRIC_PUBLISHES_FAILED[] PROGMEM = "publish_failed";
+  static const char METRIC_PEERS[] PROGMEM = "peers";
+  static const char METRIC_EVICTIONS[] PROGMEM = "evictions";
+  static const char METRIC_PROBE_DROPS[] PROGMEM = "probe_drops";
+  static const char METRIC_FREE_HEAP[] PROGMEM = "free_heap";
+  static const char METRIC_LOOP_AVG[] PROGMEM = "loop_avg_us";
+  static const char METRIC_LOOP_MAX[] PROGMEM = "loop_max_us";
+  static const char METRIC_UPTIME[] PROGMEM = "uptime";
+  static const char * const METRIC_NAMES[] PROGMEM = { METRIC_FRAMES, METRIC_MALFORMED, METRIC_DUPLICATES, METRIC_REORDERED,
+    METRIC_LOST, METRIC_ACKS_OK, METRIC_ACKS_FAILED, METRIC_PUBLISHES_FAILED, METRIC_PEERS, METRIC_EVICTIONS,
+    METRIC_PROBE_DROPS, METRIC_FREE_HEAP, METRIC_LOOP_AVG, METRIC_LOOP_MAX, METRIC_UPTIME };
+  const uint8_t MAX_NAME = 14; // Longest of METRIC_NAMES
+
+  static char topic[sizeof(MQTT_PREFIX) - 1 + sizeof(MQTT_SYS_TOPIC) - 1 + 8 + 1 + MAX_NAME + 1];
+  char *name;
+  uint32_t values[sizeof(METRIC_NAMES) / sizeof(METRIC_NAMES[0])];
+
+  values[0] = metrics.frames;
+  values[1] = metrics.malformed;
+  values[2] = metrics.duplicates;
+  values[3] = metrics.reordered;
+  values[4] = metrics.lost;
+  values[5] = metrics.acks_ok;
+  values[6] = metrics.acks_failed;
+  values[7] = metrics.publishes_failed;
+  values[8] = peers;
+  values[9] = esp_now ? ((EspNowServerPlus*)esp_now)->evictions() : 0;
+  values[10] = esp_now ? ((EspNowServerPlus*)esp_now)->probeDrops() : 0;
+  values[11] = ESP.getFreeHeap();
+  values[12] = metrics.loops ? metrics.loop_sum / metrics.loops : 0;
+  values[13] = metrics.loop_max;
+  values[14] = millis() / 1000;
+  metrics.loop_max = metrics.loop_sum = metrics.loops = 0; // Loop time is per period, counters are cumulative
+  strcpy_P(topic, MQTT_PREFIX);
+  strcat_P(topic, MQTT_SYS_TOPIC);
+  name = &topic[strlen(topic)];
+  idToTopic(name, ESP.getChipId());
+  name += 8;
+  *name++ = '/';
+  for (uint8_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    strcpy_P(name, (PGM_P)pgm_read_ptr(&METRIC_NAMES[i]));
+    ultoa(values[i], mqttValue, 10);
+    mqttPublish(topic, mqttValue);
+  }
+}
+
+// Counters of one peer as "received,duplicates,reordered,lost", one publish per peer
+static void mqttPeerMetrics(const char *topic_id, uint32_t received, uint32_t duplicates, uint32_t reordered, uint32_t lost) {
+  static const char METRIC_PEER[] PROGMEM = "/peer/";
+
+  char topic[sizeof(MQTT_PREFIX) - 1 + sizeof(MQTT_SYS_TOPIC) - 1 + 8 + sizeof(METRIC_PEER) - 1 + 8 + 1];
+  char value[4 * 11];
+  char *p;
+
+  strcpy_P(topic, MQTT_PREFIX);
+  strcat_P(topic, MQTT_SYS_TOPIC);
+  p = &topic[strlen(topic)];
+  idToTopic(p, ESP.getChipId());
+  strcpy_P(&p[8], METRIC_PEER);
+  p += 8 + sizeof(METRIC_PEER) - 1;
+  memcpy(p, topic_id, 8);
+  p[8] = '\0';
+  ultoa(received, value, 10);
+  p = &value[strlen(value)];
+  *p++ = ',';
+  ultoa(duplicates, p, 10);
+  p += strlen(p);
+  *p++ = ',';
+  ultoa(reordered, p, 10);
+  p += strlen(p);
+  *p++ = ',';
+  ultoa(lost, p, 10);
+  mqttPublish(topic, value);
+}
+
+static void mqttStore(const publish_t *publish) {
+  // Uplink is down or logged readings are not published yet, log it to keep the order
+  if (logReady && (readingsLog.count() || (! mqtt->connected())) && readingsLog.append(publish, LOG_RECORD))
+    return;
+  if (mqtt->connected() && (! mqttQueue.count()) && (! readingsLog.count()) && mqttPublish(publish)) { // Nothing to wait for
+    publishLatency.add(micros() - publish->time);
+    return;
+  }
+  mqttQueue.put(*publish);
+}
 #endif
 
-static String macToString(const uint8_t mac[]) {
-  char str[18];
+static const char *macToString(const uint8_t mac[]) { // Static buffer, valid until next call
+  static char str[18];
+
+  for (uint8_t i = 0; i < 6; ++i) {
+    str[i * 3] = hexDigit(mac[i] >> 4);
+    str[i * 3 + 1] = hexDigit(mac[i] & 0x0F);
+    str[i * 3 + 2] = i < 5 ? ':' : '\0';
+  }
 
-  sprintf_P(str, PSTR("%02X:%02X:%02X:%02X:%02X:%02X"), mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return str;
+}
 
-  return String(str);
+static void printLatency(const __FlashStringHelper *stage, Log2Histogram &latency) { // Clears it for next period
+  if (! latency.count())
+    return;
+  Serial.print(F("Latency of "));
+  Serial.print(stage);
+  Serial.print(F(": "));
+  Serial.print(latency.count());
+  Serial.print(F(" samples, p50 "));
+  Serial.print(latency.percentile(50));
+  Serial.print(F(" us., p99 "));
+  Serial.print(latency.percentile(99));
+  Serial.print(F(" us., max "));
+  Serial.print(latency.max());
+  Serial.println(F(" us."));
+  latency.clear();
 }
 
 void setup() {
@@ -420,50 +1742,102 @@ void setup() {
   wifiConnectHandler = WiFi.onStationModeGotIP(onWifiConnected);
   wifiDisconnectHandler = WiFi.onStationModeDisconnected(onWifiDisconnected);
 
+  strcpy_P(mqttTopic, MQTT_PREFIX);
+  logReady = readingsLog.begin();
+  if (logReady) {
+    Serial.print(F("Readings log has "));
+    Serial.print(readingsLog.count());
+    Serial.println(F(" unpublished reading(s)"));
+  } else {
+    Serial.println(F("Readings log is not available!"));
+  }
+  snprintf(mqttClientId, sizeof(mqttClientId), "%s%08X", MQTT_CLIENT, ESP.getChipId());
 #ifdef ASYNC_MQTT
   mqtt = new AsyncMqttClient();
   mqtt->setServer(MQTT_SERVER, MQTT_PORT);
-  mqtt->setClientId(MQTT_CLIENT);
+  mqtt->setClientId(mqttClientId);
   mqtt->onConnect(onMqttConnected);
+  mqtt->onMessage(onMqttMessage);
 #else
   mqtt = new PubSubClient(*new WiFiClient());
   mqtt->setServer(MQTT_SERVER, MQTT_PORT);
+  mqtt->setCallback(onMqttMessage);
 #endif
 #else
   WiFi.mode(WIFI_STA);
   WiFi.disconnect();
   {
-    int8_t channel;
-    uint8_t mac[6];
-    int8_t rssi;
+    const espnow_server_t *server;
     uint32_t start;
-
+    bool resumed = rtcLoad(); // false after power on
+
+    if (! resumed)
+      memset(&rtcState, 0, sizeof(rtcState));
+#ifdef DEEP_SLEEP
+    if ((rtcState.fails >= MAX_WAKE_FAILS) && nextServer())
+      Serial.println(F("Failing over to next ESP-NOW server"));
+    if (rtcState.server_count && (rtcState.fails < MAX_WAKE_FAILS)) { // Discovery is most of the time awake, so skip it while ACKs come
+      Serial.print(F("Cached ESP-NOW server"));
+    } else {
+      Serial.print(F("Waiting for ESP-NOW server"));
+      if (! findServers()) {
+        Serial.println(F(" FAIL!"));
+        ++rtcState.fails;
+        sleep();
+      }
+    }
+#else
     Serial.print(F("Waiting for ESP-NOW server"));
-    channel = espNowFindServer(mac, &rssi);
-    if (! channel) {
+    findServers();
+#endif
+    if (! rtcState.server_count) {
       const uint32_t WAIT_SERVER_TIMEOUT = 15000; // 15 sec.
 
       led->setMode(LED_4HZ);
       start = millis();
-      while ((! channel) && (millis() - start <= WAIT_SERVER_TIMEOUT)) {
+      do {
         led->delay(1000);
         Serial.print('.');
-        channel = espNowFindServer(mac, &rssi);
-      }
+      } while ((! findServers()) && (millis() - start <= WAIT_SERVER_TIMEOUT));
     }
-    if (channel) {
-      Serial.print(F(" OK (on channel "));
-      Serial.print(channel);
+    if (rtcState.server_count) {
+      server = &rtcState.servers[rtcState.server];
+      Serial.print(F(" OK ("));
+      Serial.print(rtcState.server_count);
+      Serial.print(F(" found, on channel "));
+      Serial.print(server->channel);
       Serial.print(F(", mac: "));
-      Serial.print(macToString(mac));
+      Serial.print(macToString(server->mac));
       Serial.print(F(", rssi: "));
-      Serial.print(rssi);
-      Serial.println(F(" dB)"));
-      esp_now = new EspNowClientPlus(channel, mac);
+      Serial.print(server->rssi);
+      Serial.print(F(" dB, load: "));
+      Serial.print(server->load);
+      Serial.println(')');
+      rtcState.channel = server->channel;
+      rtcSave();
+      esp_now = new EspNowClientPlus(server->channel, server->mac);
       Serial.print(F("ESP-NOW client "));
       if (esp_now->begin()) {
         Serial.println(F("started"));
         led->setMode(LED_1HZ);
+#ifdef DEEP_SLEEP
+        if (resumed) {
+          ((EspNowClientPlus*)esp_now)->setNum(rtcState.num);
+          ((EspNowClientPlus*)esp_now)->setCommand(rtcState.command_id, rtcState.command_echo);
+        } else
+#endif
+        {
+          static char diagnostics[96];
+
+          snprintf_P(diagnostics, sizeof(diagnostics), PSTR("SDK: %s, chip ID: %08X, free heap: %u, channel: %d, rssi: %d dB"),
+            ESP.getSdkVersion(), ESP.getChipId(), ESP.getFreeHeap(), server->channel, server->rssi);
+          ((EspNowClientPlus*)esp_now)->sendMessage(SENSOR_DIAGNOSTICS, (uint8_t*)diagnostics, strlen(diagnostics));
+        }
+#ifdef DEEP_SLEEP
+        ((EspNowClientPlus*)esp_now)->sendData();
+        ((EspNowClientPlus*)esp_now)->flush();
+        sendStart = millis();
+#endif
       } else {
         reboot(F("FAIL!"));
       }
@@ -475,7 +1849,13 @@ void setup() {
 }
 
 void loop() {
+  const uint8_t TRACE_FLUSH_MAX = 8; // Events printed per loop
+
+  traceFlush(TRACE_FLUSH_MAX);
 #ifdef SERVER
+  static uint32_t lastMetrics = 0, lastLatency = 0;
+  uint32_t loopStart = micros();
+
   if (! WiFi.isConnected())
     wifiConnect();
   if (WiFi.isConnected()) {
@@ -485,47 +1865,263 @@ void loop() {
     if (mqtt && mqtt->connected())
       mqtt->loop();
 #endif
-    if (esp_now && ((EspNowServerPlus*)esp_now)->_received) {
-      for (uint8_t i = 0; i < ((EspNowServerPlus*)esp_now)->_peer_count; ++i) {
-        EspNowServerPlus::peer_t *peer = &((EspNowServerPlus*)esp_now)->_peers[i];
-
-        if (! peer->acknowledged) {
-          Serial.print(F("Sending ACK "));
-          if (((EspNowServerPlus*)esp_now)->sendAck(peer->mac)) {
-            Serial.println("OK");
-          } else {
-            Serial.println("FAIL!");
-          }
-          if (mqtt && mqtt->connected()) {
-            char mqtt_topic[sizeof(MQTT_UPTIME_TOPIC)];
-            char value[11];
+  }
+  if (esp_now) {
+    uint16_t peers = ((EspNowServerPlus*)esp_now)->_peers.count() * 255UL / ((EspNowServerPlus*)esp_now)->_peers.capacity();
+    uint16_t queued = mqttQueue.count() * 255UL / MQTT_QUEUE_SIZE;
 
-            strcpy_P(mqtt_topic, MQTT_UPTIME_TOPIC);
-            mqttPublish(mqtt_topic, ultoa(peer->payload.uptime, value, 10), peer->payload.id);
+    ((EspNowServerPlus*)esp_now)->setLoad(peers > queued ? peers : queued); // Probing clients prefer less loaded gateways
+    esp_now->poll();
+  }
+  if (esp_now && ((EspNowServerPlus*)esp_now)->_received) {
+    static uint32_t lastOverflows = 0;
+
+    EspNowServerPlus::frame_t frame;
+    EspNowServerPlus::peer_t *peer = NULL;
+    bool fresh = false;
+    bool skip = false;
+
+    ((EspNowServerPlus*)esp_now)->_received = false; // Before draining, so a frame queued meanwhile sets it again
+    while (((EspNowServerPlus*)esp_now)->_frames.get(frame)) {
+      if (! frame.index) { // Batch is acked and deduplicated as a whole by its first record
+        drainLatency.add(micros() - frame.time);
+        // Publish queue is near full, leave new batches unacked so clients back off and resend later
+        skip = mqttQueue.throttled() && (frame.wire != TLV_BYTES) && (! ((EspNowServerPlus*)esp_now)->isSeen(&frame));
+        if (skip) {
+          ++mqttThrottled;
+          continue;
+        }
+        peer = ((EspNowServerPlus*)esp_now)->peerByFrame(&frame, &fresh);
+        // Duplicate means our ACK was lost, so ack it again unless it was just sent
+        if (peer && (fresh || (! peer->acknowledged) || (peer->ack_num != frame.num) ||
+          ((uint16_t)((uint16_t)millis() - peer->ack_time) >= EspNowServerPlus::ACK_HOLDOFF)))
+          ((EspNowServerPlus*)esp_now)->queueAck(peer, frame.num, frame.time);
+      }
+      if (skip)
+        continue;
+      if (frame.wire == TLV_BYTES) { // Fragment, message is published once complete
+        if (frame.value < EspNowServerPlus::MAX_MESSAGES) {
+          EspNowServerPlus::message_t *message = &((EspNowServerPlus*)esp_now)->_messages[frame.value];
+
+          if (peer && fresh) { // Held in arena until published, so it survives MQTT outage
+            message->key = frame.key;
+            message->done = frame.time;
+            message->state = EspNowServerPlus::MESSAGE_HELD;
+          } else {
+            ((EspNowServerPlus*)esp_now)->freeMessage(frame.value);
           }
         }
+      } else if (peer && fresh && (frame.key == SENSOR_COMMAND)) {
+        ((EspNowServerPlus*)esp_now)->confirmCommand(frame.id, frame.value);
+      } else if (peer && fresh) {
+        publish_t publish;
+
+        publish.id = frame.id;
+        publish.key = frame.key;
+        publish.wire = frame.wire;
+        publish.value = frame.value;
+        publish.time = frame.time;
+        if (frame.id != macToId(peer->mac)) // Record of other ID, rare
+          idToTopic(publish.topic_id, frame.id);
+        else
+          memcpy(publish.topic_id, peer->topic_id, sizeof(publish.topic_id));
+        mqttStore(&publish);
+      }
+    }
+    ((EspNowServerPlus*)esp_now)->flushAcks();
+    if (((EspNowServerPlus*)esp_now)->overflows() != lastOverflows) {
+      lastOverflows = ((EspNowServerPlus*)esp_now)->overflows();
+      Serial.print(F("ESP-NOW receive queue overflows: "));
+      Serial.println(lastOverflows);
+    }
+  }
+  if (esp_now) {
+    command_t command;
+
+    ((EspNowServerPlus*)esp_now)->expireCommands();
+    while (mqttCommands.get(command)) {
+      char id[9];
+
+      idToTopic(id, command.id);
+      id[8] = '\0';
+      if (((EspNowServerPlus*)esp_now)->postCommand(command.id, command.data, command.len)) {
+        Serial.print(F("Command for "));
+        Serial.print(id);
+        Serial.println(F(" waits for its next packet"));
+      } else {
+        Serial.print(F("Command for "));
+        Serial.print(id);
+        Serial.println(F(" rejected, unknown peer or mailbox is full!"));
+      }
+    }
+  }
+  if (esp_now && mqtt && mqtt->connected()) { // Complete messages, new ones wait unacked while arena is full of held ones
+    for (uint8_t i = 0; i < EspNowServerPlus::MAX_MESSAGES; ++i) {
+      const EspNowServerPlus::message_t *message = &((EspNowServerPlus*)esp_now)->_messages[i];
+
+      if (message->state == EspNowServerPlus::MESSAGE_HELD) {
+        char id[8];
+
+        idToTopic(id, macToId(message->mac));
+        if (! mqttPublish(mqttRenderTopic(message->key, id), (const char*)&((EspNowServerPlus*)esp_now)->_arena[message->offset],
+          message->length))
+          break; // Client buffer is full, retry on next loop
+        publishLatency.add(micros() - message->done);
+        ((EspNowServerPlus*)esp_now)->freeMessage(i);
+      }
+    }
+  }
+  if (mqtt && mqtt->connected()) {
+    const publish_t *publish;
+
+    while ((publish = mqttQueue.peek()) != NULL) {
+      if (! mqttPublish(publish))
+        break; // Client buffer is full, retry on next loop
+      publishLatency.add(micros() - publish->time);
+      mqttQueue.pop();
+    }
+  }
+  if (logReady) {
+    static uint32_t lastDrain = 0, lastFlush = 0;
+
+    if (logDrain && mqtt && mqtt->connected() && (! mqttQueue.count()) && (millis() - lastDrain >= LOG_DRAIN_PERIOD)) {
+      publish_t publish;
+      uint8_t len;
+
+      for (uint8_t i = 0; (i < LOG_DRAIN_BATCH) && ((len = readingsLog.peek(&publish)) != 0); ++i) {
+        if ((len == LOG_RECORD) && (! mqttPublish(&publish)))
+          break;
+        readingsLog.pop();
       }
-      ((EspNowServerPlus*)esp_now)->_received = false;
+      if (! readingsLog.count()) {
+        logDrain = false;
+        Serial.print(F("Readings log is published, "));
+        Serial.print(readingsLog.lost());
+        Serial.println(F(" reading(s) lost"));
+      }
+      readingsLog.commit();
+      lastDrain = lastFlush = millis();
+    } else if (millis() - lastFlush >= LOG_FLUSH_PERIOD) {
+      readingsLog.commit();
+      lastFlush = millis();
     }
   }
+  {
+    static uint32_t lastDropped = 0, lastThrottled = 0;
+
+    if ((mqttQueue.dropped() != lastDropped) || (mqttThrottled != lastThrottled)) {
+      lastDropped = mqttQueue.dropped();
+      lastThrottled = mqttThrottled;
+      Serial.print(F("MQTT queue dropped "));
+      Serial.print(lastDropped);
+      Serial.print(F(", unacked "));
+      Serial.print(lastThrottled);
+      Serial.println(F(" batch(es)"));
+    }
+  }
+  {
+    uint32_t elapsed = micros() - loopStart;
+
+    metrics.loop_sum += elapsed;
+    if (elapsed > metrics.loop_max)
+      metrics.loop_max = elapsed;
+    ++metrics.loops;
+  }
+  if ((millis() - lastMetrics >= METRICS_PERIOD) && mqtt && mqtt->connected()) {
+    mqttMetrics(esp_now ? ((EspNowServerPlus*)esp_now)->_peers.count() : 0);
+    if (esp_now) {
+      PeerTable<EspNowServerPlus::peer_t, EspNowServerPlus::PEER_SLOTS> *peers = &((EspNowServerPlus*)esp_now)->_peers;
+
+      for (uint16_t i = 0; i < peers->size(); ++i) {
+        if (peers->used(i))
+          mqttPeerMetrics((*peers)[i].topic_id, (*peers)[i].received, (*peers)[i].duplicates, (*peers)[i].reordered,
+            (*peers)[i].lost);
+      }
+    }
+    lastMetrics = millis();
+  }
+  if (millis() - lastLatency >= LATENCY_PERIOD) {
+    printLatency(F("drain"), drainLatency);
+    printLatency(F("ACK"), ackLatency);
+    printLatency(F("publish"), publishLatency);
+    lastLatency = millis();
+  }
+#elif defined(DEEP_SLEEP)
+  ((EspNowClientPlus*)esp_now)->poll();
+  while (((EspNowClientPlus*)esp_now)->_oks) {
+    --((EspNowClientPlus*)esp_now)->_oks;
+    Serial.println(F("Sending DATA packet OK"));
+    rtcState.fails = 0;
+  }
+  while (((EspNowClientPlus*)esp_now)->_fails) {
+    --((EspNowClientPlus*)esp_now)->_fails;
+    Serial.println(F("Sending DATA packet FAIL!"));
+    if (rtcState.fails < 0xFF)
+      ++rtcState.fails;
+  }
+  if (((EspNowClientPlus*)esp_now)->_command_len) {
+    Serial.print(F("Command received: \""));
+    Serial.print(((EspNowClientPlus*)esp_now)->_command);
+    Serial.println('"');
+    ((EspNowClientPlus*)esp_now)->_command_len = 0;
+  }
+  if (((EspNowClientPlus*)esp_now)->idle() || (millis() - sendStart >= MAX_AWAKE)) {
+    if (! ((EspNowClientPlus*)esp_now)->idle()) {
+      Serial.println(F("No ACK in time!"));
+      if (rtcState.fails < 0xFF)
+        ++rtcState.fails;
+    }
+    rtcState.num = ((EspNowClientPlus*)esp_now)->num();
+    rtcState.command_id = ((EspNowClientPlus*)esp_now)->_command_id;
+    rtcState.command_echo = ((EspNowClientPlus*)esp_now)->_command_echo;
+    printLatency(F("transmit"), txLatency); // Of this wake only
+    printLatency(F("ACK"), ackLatency);
+    sleep();
+  }
 #else
   const uint32_t SEND_PERIOD = 5000; // 5 sec.
   const uint8_t MAX_ERRORS = 5;
 
-  static uint32_t lastSend = 0;
+  static uint32_t lastSend = 0, lastLatency = 0;
   static uint8_t errors = 0;
 
-  if ((! lastSend) || (millis() - lastSend >= SEND_PERIOD)) {
-    Serial.print(F("Sending DATA packet "));
-    if (((EspNowClientPlus*)esp_now)->sendData()) {
-      Serial.println(F("OK"));
-      errors = 0;
-    } else {
-      Serial.println(F("FAIL!"));
-      if (++errors >= MAX_ERRORS)
-        reboot(F("Too many errors (connection lost)!"));
+  ((EspNowClientPlus*)esp_now)->poll();
+  while (((EspNowClientPlus*)esp_now)->_oks) {
+    --((EspNowClientPlus*)esp_now)->_oks;
+    Serial.println(F("Sending DATA packet OK"));
+    errors = 0;
+  }
+  while (((EspNowClientPlus*)esp_now)->_fails) {
+    --((EspNowClientPlus*)esp_now)->_fails;
+    Serial.println(F("Sending DATA packet FAIL!"));
+    if (++errors >= MAX_ERRORS)
+      reboot(F("Too many errors (connection lost)!"));
+    if (nextServer()) { // Reading failed after all repeats and backoffs, try next ranked gateway
+      const espnow_server_t *server = &rtcState.servers[rtcState.server];
+
+      Serial.print(F("Failing over to ESP-NOW server "));
+      Serial.print(macToString(server->mac));
+      Serial.print(F(" on channel "));
+      Serial.println(server->channel);
+      if (! ((EspNowClientPlus*)esp_now)->setServer(server->channel, server->mac))
+        reboot(F("Failover FAIL!"));
+      rtcSave();
     }
-    lastSend = millis();
+  }
+  if (((EspNowClientPlus*)esp_now)->_command_len) {
+    Serial.print(F("Command received: \""));
+    Serial.print(((EspNowClientPlus*)esp_now)->_command);
+    Serial.println('"');
+    ((EspNowClientPlus*)esp_now)->_command_len = 0;
+  }
+  if ((! lastSend) || (millis() - lastSend >= SEND_PERIOD)) {
+    if (((EspNowClientPlus*)esp_now)->sendData())
+      lastSend = millis();
+  }
+  if (millis() - lastLatency >= LATENCY_PERIOD) {
+    printLatency(F("transmit"), txLatency);
+    printLatency(F("ACK"), ackLatency);
+    lastLatency = millis();
   }
 #endif
   led->delay(1);